@@ -0,0 +1,87 @@
+/*
+Giacomo Arrigo 860022
+Marco Carfizzi 860149
+*/
+
+#include "frames.h"
+
+// A frame of a batch: the scene to draw and the model transform placing it in front of the camera.
+// The scene is only referenced, so any number of jobs can draw the same mesh under different transforms
+// without copying its vertices or triangles; it must outlive the call to BatchRenderer::render.
+struct RenderJob{
+    const Scene* scene;
+    ModelTransform model;
+};
+
+// Renders many independent frames at once, one job per worker at a time. Every worker owns a single threaded Pipeline
+// (with its z-buffer and transformed vertices), so the jobs need no synchronization; jobs are handed out dynamically,
+// so small and large scenes can be mixed. The fragment shader is shared by the workers and must not modify shared state.
+// Example:
+//     BatchRenderer<char, Dynamic, Dynamic> batch(64, 64, pm, &shader);
+//     std::vector<RenderJob> jobs;
+//     for (double angle = 0; angle < 6.28; angle += 0.01)
+//         jobs.push_back({&mesh, ModelTransform::translation(0, 0, 3) * ModelTransform::rotationY(angle)});
+//     std::vector<Render<char, Dynamic, Dynamic>> frames;
+//     batch.render(jobs, frames);
+template <typename target_t, size_t C, size_t R, typename shader_t = IFragmentShader<target_t>, typename precision_t = DoublePrecision>
+class BatchRenderer{
+    public:
+        using pipeline_t = Pipeline<target_t, C, R, shader_t, precision_t>;
+        using render_t = Render<target_t, C, R>;
+
+    private:
+        size_t width_, height_;
+        std::vector<pipeline_t> pipelines_;
+
+    public:
+        // threads is the number of workers (0 uses all the hardware threads)
+        BatchRenderer(ProjectionMatrix pm, shader_t *fs, size_t threads = 0) : BatchRenderer(C, R, pm, fs, threads){
+            static_assert(C != Dynamic && R != Dynamic, "A Dynamic batch renderer needs the resolution in the constructor");
+        }
+
+        // Constructor with the resolution of the frames, needed when C and R are Dynamic
+        BatchRenderer(size_t width, size_t height, ProjectionMatrix pm, shader_t *fs, size_t threads = 0) : width_(width), height_(height){
+            pipelines_.reserve(resolveThreadCount(threads));
+            for (size_t i = 0; i < resolveThreadCount(threads); i++)
+                pipelines_.emplace_back(width, height, pm, fs);
+        }
+
+        // Call configure(pipeline) on the pipeline of every worker, e.g. to set the cull mode or the depth sort.
+        // The pipelines must stay single threaded, the parallelism comes from the jobs
+        template <typename configure_f>
+        BatchRenderer& configure(configure_f&& configure){
+            for (pipeline_t& pipeline : pipelines_){
+                configure(pipeline);
+                pipeline.setThreads(1);
+            }
+            return *this;
+        }
+
+        size_t getThreads() const {return pipelines_.size();}
+
+        // Render every job and call output(frame, job_index) on the worker that drew it, as soon as the frame is ready.
+        // The frame belongs to the worker and is reused by its next job, so output has to copy or save what it needs
+        template <typename output_f>
+        BatchRenderer& render(const std::vector<RenderJob>& jobs, output_f&& output){
+            parallelFor(pipelines_.size(), jobs.size(), [&](size_t j, size_t worker){
+                const pipeline_t& pipeline = pipelines_[worker].render(*jobs[j].scene, jobs[j].model);
+                output(pipeline.getRender(), j);
+            });
+            return *this;
+        }
+
+        // Render every job into frames[job_index]. Frames are added to the vector when it's too short, existing ones
+        // are reused and must have the resolution of the batch. Each finished frame is swapped with the render of
+        // the worker, so no pixels are copied.
+        BatchRenderer& render(const std::vector<RenderJob>& jobs, std::vector<render_t>& frames){
+            const size_t reused = std::min(frames.size(), jobs.size());
+            frames.reserve(jobs.size());
+            while (frames.size() < jobs.size())
+                frames.emplace_back(width_, height_);
+            parallelFor(pipelines_.size(), jobs.size(), [&](size_t j, size_t worker){
+                // Frames that were just created are blank, the worker can skip clearing them for its next job
+                pipelines_[worker].render(*jobs[j].scene, jobs[j].model).swapRender(frames[j], j >= reused);
+            });
+            return *this;
+        }
+};
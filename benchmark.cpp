@@ -0,0 +1,205 @@
+/*
+Giacomo Arrigo 860022
+Marco Carfizzi 860149
+*/
+
+// Stage timings are collected by the pipeline only with this macro defined before including it
+#ifndef PIPELINE3D_PROFILE
+#define PIPELINE3D_PROFILE
+#endif
+#include "pipeline.h"
+#include <random>
+#include <chrono>
+
+// Parameters of a synthetic scene, seen through ProjectionMatrix(-1, 1, -1, 1, 1, 2)
+struct SceneParams{
+    // Number of triangles
+    size_t triangles;
+    // Side of the (equilateral) triangles in ndc units, the screen is 2 units wide
+    double size;
+    // Average number of on-screen triangles covering a pixel of the region they are spread over:
+    // the triangles are packed in a square around the center of the screen small enough to reach it (0 uses the whole screen)
+    double depth_complexity;
+    // Share of triangles placed entirely outside the frustum, half beside the screen and half between the eye and the near plane
+    double offscreen;
+    unsigned seed;
+};
+
+// Builds a scene of randomly rotated triangles at random depths according to the parameters
+Scene syntheticScene(const SceneParams& params){
+    std::mt19937 gen(params.seed);
+    std::uniform_real_distribution<double> unit(0, 1), depth(1.05, 1.95), near_depth(0.3, 0.9);
+    const double pi = std::acos(-1.0);
+    const size_t offscreen = (size_t)(params.triangles * params.offscreen);
+    const size_t onscreen = params.triangles - offscreen;
+    // Side of the square where the on-screen triangles are placed, so that their total area matches the depth complexity
+    const double area = std::sqrt(3.0) / 4 * params.size * params.size;
+    const double max_side = std::max(0.0, 2 * 0.99 - params.size);
+    double side = max_side;
+    if (params.depth_complexity > 0)
+        side = std::min(max_side, std::sqrt(onscreen * area / params.depth_complexity));
+
+    std::vector<Vertex> vertices;
+    std::vector<Triangle> triangles;
+    vertices.reserve(params.triangles * 3);
+    triangles.reserve(params.triangles);
+    for (size_t i = 0; i < params.triangles; i++){
+        double cx = (unit(gen) - 0.5) * side, cy = (unit(gen) - 0.5) * side, z = depth(gen);
+        // Off-screen triangles are spread evenly among the visible ones, as they would be in a real scene
+        if (std::floor((i + 1) * params.offscreen) > std::floor(i * params.offscreen)){
+            if (i % 2)
+                cx = 2 + unit(gen);
+            else
+                z = near_depth(gen);
+        }
+        double rotation = unit(gen) * 2 * pi;
+        for (int k = 0; k < 3; k++){
+            // Vertices of an equilateral triangle of side "size", the circumradius is size / sqrt(3)
+            double angle = rotation + k * 2 * pi / 3;
+            double nx = cx + params.size / std::sqrt(3.0) * std::cos(angle);
+            double ny = cy + params.size / std::sqrt(3.0) * std::sin(angle);
+            // ndx = x / z, so the x and y coordinates are scaled by the depth to keep the projected size constant
+            vertices.emplace_back(nx * z, ny * z, z);
+        }
+        triangles.push_back({3 * i, 3 * i + 1, 3 * i + 2});
+    }
+    return Scene(std::move(vertices), std::move(triangles));
+}
+
+// Shader for the double pipeline, writing the depth of the fragment
+class DepthShader final : public FragmentShader<DepthShader, double>{
+    public:
+        inline double shade(double, double, double z, double, double, double, double, double){
+            return z;
+        }
+};
+
+// Average wall time (milliseconds) of a render over "runs" frames, after a first frame that is not measured.
+// With "cold" the projection matrix is set again before every frame, so the vertices are transformed and assembled
+// each time instead of being reused from the previous frame
+template <typename pipeline_t>
+double timeRender(pipeline_t& pipeline, const ProjectionMatrix& pm, const Scene& scene, int runs, bool cold){
+    pipeline.render(scene);
+    pipeline.resetStageTimes();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++){
+        if (cold)
+            pipeline.setProjectionMatrix(pm);
+        pipeline.render(scene);
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / runs;
+}
+
+// Renders a scene with a Pipeline<target_t, Dynamic, Dynamic, shader_t> and prints a line of results
+template <typename target_t, typename shader_t>
+void benchmarkCase(const char* target_name, size_t width, size_t height, size_t threads, const SceneParams& params,
+                   const Scene& scene, int runs){
+    const ProjectionMatrix pm(-1, 1, -1, 1, 1, 2);
+    shader_t shader;
+    Pipeline<target_t, Dynamic, Dynamic, shader_t> pipeline(width, height, pm, &shader);
+    pipeline.setThreads(threads);
+    double ms = timeRender(pipeline, pm, scene, runs, true);
+    StageTimes t = pipeline.getStageTimes();
+    double frames = t.frames ? t.frames : 1;
+    std::cout << target_name << "," << width << "," << height << "," << threads << ","
+              << params.triangles << "," << params.size << "," << params.depth_complexity << "," << params.offscreen << ","
+              << runs << "," << ms << ","
+              << params.triangles / (ms * 1e-3) << "," << t.fragments / frames / (ms * 1e-3) << ","
+              << t.fragments / frames / (width * height) << ","
+              << t.clear / frames << "," << t.ndc / frames << "," << t.assembly / frames << "," << t.setup / frames << ","
+              << t.raster / frames << "," << t.shading / frames << "\n";
+}
+
+// Every scene through the char, int and double pipelines at several resolutions, one CSV line per case.
+// Per-stage times are milliseconds per frame; raster includes the shading
+void suite(size_t threads, int runs){
+    const std::vector<std::array<size_t, 2>> resolutions = {{{320, 240}}, {{1280, 720}}, {{1920, 1080}}};
+    const std::vector<SceneParams> scenes = {
+        {10000, 0.02, 1, 0, 1},         // small triangles, little overdraw
+        {10000, 0.1, 4, 0, 2},          // medium triangles
+        {1000, 0.5, 8, 0, 3},           // large triangles, high depth complexity
+        {100000, 0.01, 2, 0, 4},        // many tiny triangles
+        {20000, 0.05, 2, 0.5, 5}        // half of the geometry off-screen
+    };
+
+    std::cout << "target,width,height,threads,triangles,size,depth_complexity,offscreen,frames,ms_per_frame,"
+                 "tris_per_s,frags_per_s,frags_per_pixel,clear_ms,ndc_ms,assembly_ms,setup_ms,raster_ms,shading_ms\n";
+    for (const SceneParams& params : scenes){
+        Scene scene = syntheticScene(params);
+        for (const std::array<size_t, 2>& resolution : resolutions){
+            benchmarkCase<char, SimpleFragmentShader>("char", resolution[0], resolution[1], threads, params, scene, runs);
+            benchmarkCase<int, SimpleIntShader>("int", resolution[0], resolution[1], threads, params, scene, runs);
+            benchmarkCase<double, DepthShader>("double", resolution[0], resolution[1], threads, params, scene, runs);
+        }
+    }
+}
+
+// Renders the same scene with 1 to N threads, reports the speedup and checks the output against the single threaded frame
+void threadScaling(size_t max_threads){
+    const size_t W = 1280, H = 720;
+    ProjectionMatrix pm(-1, 1, -1, 1, 1, 2);
+    SimpleFragmentShader sfs;
+    Scene scene = syntheticScene({20000, 0.1, 0, 0, 42});
+
+    Pipeline<char, Dynamic, Dynamic> pipeline(W, H, pm, &sfs);
+    double base = timeRender(pipeline, pm, scene, 5, false);
+    Render<char, Dynamic, Dynamic> reference(pipeline.getRender());
+
+    std::cout << "threads,ms_per_frame,speedup,identical\n";
+    std::cout << 1 << "," << base << "," << 1.0 << "," << 1 << "\n";
+    for (size_t threads = 2; threads <= max_threads; threads++){
+        pipeline.setThreads(threads);
+        double ms = timeRender(pipeline, pm, scene, 5, false);
+        bool identical = pipeline.getRender().getTarget() == reference.getTarget();
+        std::cout << threads << "," << ms << "," << base / ms << "," << identical << "\n";
+    }
+}
+
+// Renders the same scene into an int target with 1 to 8 samples per pixel. Reports the cost against the single sampled
+// frame and checks that every resolved pixel is the background or a value of SimpleIntShader (0 to 9): averaging the
+// background with the shaded samples of an edge would give values no triangle has
+void multisample(size_t threads){
+    const size_t W = 1280, H = 720;
+    ProjectionMatrix pm(-1, 1, -1, 1, 1, 2);
+    SimpleIntShader ifs;
+    Scene scene = syntheticScene({20000, 0.1, 0, 0, 42});
+
+    Pipeline<int, Dynamic, Dynamic, SimpleIntShader, FixedPointPrecision<4>> pipeline(W, H, pm, &ifs);
+    pipeline.setThreads(threads);
+    double base = 0;
+    std::cout << "samples,ms_per_frame,cost,valid\n";
+    for (size_t samples : {1, 2, 4, 8}){
+        pipeline.setMultisample(samples);
+        double ms = timeRender(pipeline, pm, scene, 5, false);
+        if (samples == 1)
+            base = ms;
+        const int* pixels = pipeline.getRender().getTarget().data();
+        bool valid = std::all_of(pixels, pixels + W * H, [](int p){return p == ' ' || (p >= 0 && p <= 9);});
+        std::cout << samples << "," << ms << "," << ms / base << "," << valid << "\n";
+    }
+}
+
+// Usage:
+//   benchmark [suite] [threads] [frames]    synthetic scenes suite (1 thread and 5 frames per case by default)
+//   benchmark scaling [max_threads]         thread scaling, up to the hardware threads by default
+//   benchmark multisample [threads]         multisample anti-aliasing cost and check of the resolved int pixels
+int main(int argc, char** argv){
+    std::string mode = argc > 1 ? argv[1] : "suite";
+    if (mode == "scaling"){
+        size_t max_threads = argc > 2 ? std::stoul(argv[2]) : resolveThreadCount(0);
+        threadScaling(std::max<size_t>(max_threads, 2));
+    }
+    else if (mode == "multisample")
+        multisample(argc > 2 ? std::stoul(argv[2]) : 1);
+    else if (mode == "suite"){
+        size_t threads = argc > 2 ? std::stoul(argv[2]) : 1;
+        int runs = argc > 3 ? std::stoi(argv[3]) : 5;
+        suite(threads, std::max(runs, 1));
+    }
+    else {
+        std::cerr << "Usage: " << argv[0] << " [suite [threads] [frames] | scaling [max_threads] | multisample [threads]]\n";
+        return 1;
+    }
+    return 0;
+}
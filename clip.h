@@ -0,0 +1,117 @@
+/*  
+Giacomo Arrigo 860022
+Marco Carfizzi 860149
+*/
+
+#include "transform.h"
+
+// Bits of the outcode of a vertex, one for each plane the vertex lies outside of
+// The GUARD planes delimit a band GUARD_BAND times as large as the screen: triangles are clipped against the sides of the
+// frustum only when they cross it, which keeps the screen coordinates small enough for the integer edge equations
+constexpr unsigned CLIP_LEFT = 1, CLIP_RIGHT = 2, CLIP_TOP = 4, CLIP_BOTTOM = 8, CLIP_NEAR = 16, CLIP_FAR = 32;
+constexpr unsigned GUARD_LEFT = 64, GUARD_RIGHT = 128, GUARD_TOP = 256, GUARD_BOTTOM = 512;
+constexpr unsigned CLIP_FRUSTUM = CLIP_LEFT | CLIP_RIGHT | CLIP_TOP | CLIP_BOTTOM | CLIP_NEAR | CLIP_FAR;
+constexpr unsigned CLIP_NEEDED = CLIP_NEAR | GUARD_LEFT | GUARD_RIGHT | GUARD_TOP | GUARD_BOTTOM;
+// Set for a vertex with a NaN or infinite coordinate, which can be neither clipped nor placed on the screen
+constexpr unsigned CLIP_INVALID = 1024;
+// Marks a vertex whose outcode was not computed yet, no vertex is outside every plane
+constexpr unsigned OUTCODE_PENDING = ~0u;
+constexpr double GUARD_BAND = 16;
+// The near plane used for clipping is moved this much (relative) away from the eye: a vertex exactly on the near plane
+// gets depth 0, which the interpolation of the depth divides by
+constexpr double NEAR_CLIP_OFFSET = 1e-6;
+
+// Which triangles are discarded according to the winding of their vertices on the screen (y pointing down)
+enum class CullMode { None, Clockwise, CounterClockwise };
+
+// Point in the (not projected) space of the scene vertices
+// b holds its barycentric coordinates in the triangle being clipped, used to interpolate the vertex attributes
+struct ViewPoint{
+    double x, y, z;
+    double b[3];
+};
+
+// Planes of the frustum of a projection matrix, written as a*X + b*Y + c*Z + d >= 0 for the points inside.
+// Since the projection is linear before the division by w = Z, the planes are linear in the scene coordinates as well,
+// so points can be classified and clipped before projecting them.
+class ClipPlanes{
+    private:
+        static constexpr int PLANES = 10;
+        std::array<std::array<double, 4>, PLANES> plane_;
+
+    public:
+        ClipPlanes(ProjectionMatrix pm, const ProjectionCoefficients& p){
+            // A vertex is on screen when lo <= x_/w <= hi, with x_ = X*x_x + Z*x_z and w = Z
+            const double x_lo = std::min(pm.getLeft(), pm.getRight()), x_hi = std::max(pm.getLeft(), pm.getRight());
+            const double y_lo = std::min(pm.getTop(), pm.getBottom()), y_hi = std::max(pm.getTop(), pm.getBottom());
+            const double x_guard = (x_hi - x_lo) * (GUARD_BAND - 1) / 2, y_guard = (y_hi - y_lo) * (GUARD_BAND - 1) / 2;
+            const double near = pm.getNear() * (1 + NEAR_CLIP_OFFSET);
+            plane_ = {{
+                {p.x_x, 0, p.x_z - x_lo, 0},                    // CLIP_LEFT
+                {-p.x_x, 0, x_hi - p.x_z, 0},                   // CLIP_RIGHT
+                {0, p.y_y, p.y_z - y_lo, 0},                    // CLIP_TOP
+                {0, -p.y_y, y_hi - p.y_z, 0},                   // CLIP_BOTTOM
+                {0, 0, 1, -near},                               // CLIP_NEAR
+                {0, 0, -1, pm.getFar()},                        // CLIP_FAR
+                {p.x_x, 0, p.x_z - x_lo + x_guard, 0},          // GUARD_LEFT
+                {-p.x_x, 0, x_hi + x_guard - p.x_z, 0},         // GUARD_RIGHT
+                {0, p.y_y, p.y_z - y_lo + y_guard, 0},          // GUARD_TOP
+                {0, -p.y_y, y_hi + y_guard - p.y_z, 0}          // GUARD_BOTTOM
+            }};
+        }
+
+        // Signed distance (scaled) of a point from plane i, negative outside
+        inline double distance(int i, const ViewPoint& v) const {
+            return plane_[i][0] * v.x + plane_[i][1] * v.y + plane_[i][2] * v.z + plane_[i][3];
+        }
+
+        // A NaN distance compares false to everything, so it counts as outside like a negative one
+        inline unsigned outcode(const ViewPoint& v) const {
+            unsigned code = std::isfinite(v.x) && std::isfinite(v.y) && std::isfinite(v.z) ? 0 : CLIP_INVALID;
+            for (int i = 0; i < PLANES; i++)
+                if (!(distance(i, v) >= 0))
+                    code |= 1u << i;
+            return code;
+        }
+
+        // True if a sphere lies entirely outside one of the planes of the frustum, so every vertex inside it gets
+        // that bit in its outcode. The distances are scaled by the length of the plane normals
+        bool sphereOutside(const ViewPoint& center, double radius) const {
+            for (int i = 0; i < PLANES; i++){
+                if (!(CLIP_FRUSTUM & (1u << i)))
+                    continue;
+                double norm = std::sqrt(plane_[i][0] * plane_[i][0] + plane_[i][1] * plane_[i][1] + plane_[i][2] * plane_[i][2]);
+                // A little slack keeps rounding from rejecting a sphere touching the plane
+                if (distance(i, center) < -radius * norm * (1 + 1e-9) - 1e-12 * norm)
+                    return true;
+            }
+            return false;
+        }
+
+        // Clip the convex polygon in[0, n) against the planes whose bits are set in mask (Sutherland-Hodgman),
+        // the result is written back in "in". Both buffers must hold n + popcount(mask) points.
+        // Returns the number of vertices of the clipped polygon (less than 3 when nothing is left)
+        size_t clip(unsigned mask, ViewPoint* in, size_t n, ViewPoint* tmp) const {
+            for (int i = 0; i < PLANES && n >= 3; i++){
+                if (!(mask & (1u << i)))
+                    continue;
+                size_t m = 0;
+                for (size_t k = 0; k < n; k++){
+                    const ViewPoint& a = in[k];
+                    const ViewPoint& b = in[(k + 1) % n];
+                    double da = distance(i, a), db = distance(i, b);
+                    if (da >= 0)
+                        tmp[m++] = a;
+                    // The edge crosses the plane: add the intersection point
+                    if ((da >= 0) != (db >= 0)){
+                        double t = da / (da - db);
+                        tmp[m++] = {a.x + t * (b.x - a.x), a.y + t * (b.y - a.y), a.z + t * (b.z - a.z),
+                                    {a.b[0] + t * (b.b[0] - a.b[0]), a.b[1] + t * (b.b[1] - a.b[1]), a.b[2] + t * (b.b[2] - a.b[2])}};
+                    }
+                }
+                std::copy(tmp, tmp + m, in);
+                n = m;
+            }
+            return n;
+        }
+};
\ No newline at end of file
@@ -0,0 +1,132 @@
+/*  
+Giacomo Arrigo 860022
+Marco Carfizzi 860149
+*/
+
+#include "scene.h"
+#include <type_traits>
+#include <cstdint>
+#include <cstring>
+
+// Size of a cache line, framebuffers start on a cache line boundary
+constexpr size_t CACHE_LINE = 64;
+
+// Heap array whose first element is aligned to a cache line, for trivially copyable pixel types
+template <typename T>
+class AlignedBuffer{
+    static_assert(std::is_trivially_copyable<T>::value, "AlignedBuffer holds trivially copyable types only");
+    private:
+        unsigned char* raw_ = nullptr;
+        T* data_ = nullptr;
+        size_t size_ = 0;
+
+        void allocate(size_t n){
+            size_ = n;
+            if (n == 0)
+                return;
+            raw_ = new unsigned char[n * sizeof(T) + CACHE_LINE];
+            std::uintptr_t address = reinterpret_cast<std::uintptr_t>(raw_);
+            data_ = reinterpret_cast<T*>(raw_ + (CACHE_LINE - address % CACHE_LINE) % CACHE_LINE);
+        }
+
+    public:
+        AlignedBuffer() = default;
+        explicit AlignedBuffer(size_t n){
+            allocate(n);
+        }
+        AlignedBuffer(const AlignedBuffer& b){
+            allocate(b.size_);
+            if (size_)
+                std::memcpy(data_, b.data_, size_ * sizeof(T));
+        }
+        AlignedBuffer(AlignedBuffer&& b) : raw_(b.raw_), data_(b.data_), size_(b.size_){
+            b.raw_ = nullptr;
+            b.data_ = nullptr;
+            b.size_ = 0;
+        }
+        AlignedBuffer& operator = (AlignedBuffer b){
+            std::swap(raw_, b.raw_);
+            std::swap(data_, b.data_);
+            std::swap(size_, b.size_);
+            return *this;
+        }
+        ~AlignedBuffer(){
+            delete[] raw_;
+        }
+
+        inline T* data() {return data_;}
+        inline const T* data() const {return data_;}
+        inline size_t size() const {return size_;}
+        inline T& operator[](size_t i) {return data_[i];}
+        inline const T& operator[](size_t i) const {return data_[i];}
+};
+
+// Pixel layouts: they map the coordinates (x, y) of a width x height image to the position of the pixel in memory
+
+// Rows one after the other, the usual layout of images
+struct LinearLayout{
+    size_t width_;
+
+    LinearLayout(size_t width = 0, size_t height = 0) : width_(width){}
+    inline size_t storage(size_t width, size_t height) const {return width * height;}
+    inline size_t index(size_t x, size_t y) const {return y * width_ + x;}
+};
+
+// Square tiles of Side x Side pixels stored one after the other (each tile row by row): the pixels of a tile share
+// a few cache lines, which suits the rasterizer walking the screen block by block. The image is padded to whole tiles.
+template <size_t Side>
+struct TiledLayout{
+    size_t tiles_x_;
+
+    TiledLayout(size_t width = 0, size_t height = 0) : tiles_x_((width + Side - 1) / Side){}
+    inline size_t storage(size_t width, size_t height) const {return tiles_x_ * ((height + Side - 1) / Side) * Side * Side;}
+    inline size_t index(size_t x, size_t y) const {
+        return ((y / Side) * tiles_x_ + x / Side) * (Side * Side) + (y % Side) * Side + x % Side;
+    }
+};
+
+// Image whose resolution is chosen at runtime, stored on the heap in cache line aligned memory
+template <typename T, typename layout_t = LinearLayout>
+class Framebuffer{
+    private:
+        size_t width_ = 0, height_ = 0;
+        layout_t layout_;
+        AlignedBuffer<T> pixels_;
+
+    public:
+        Framebuffer() = default;
+        Framebuffer(size_t width, size_t height) : width_(width), height_(height), layout_(width, height), pixels_(layout_.storage(width, height)){}
+
+        inline size_t getWidth() const {return width_;}
+        inline size_t getHeight() const {return height_;}
+
+        // Unchecked access, (x, y) must be inside the image
+        inline T& operator()(size_t x, size_t y) {return pixels_[layout_.index(x, y)];}
+        inline const T& operator()(size_t x, size_t y) const {return pixels_[layout_.index(x, y)];}
+
+        // Checked access
+        T& at(size_t x, size_t y){
+            if (x >= width_ || y >= height_)
+                throw std::out_of_range("Target indices out of range");
+            return (*this)(x, y);
+        }
+
+        // Set every pixel (padding included) to value, a plain loop over contiguous memory the compiler vectorizes
+        void fill(const T& value){
+            std::fill(pixels_.data(), pixels_.data() + pixels_.size(), value);
+        }
+
+        // Raw storage, in the order given by the layout (row by row for LinearLayout)
+        inline T* data() {return pixels_.data();}
+        inline const T* data() const {return pixels_.data();}
+        inline size_t size() const {return pixels_.size();}
+        inline T* begin() {return pixels_.data();}
+        inline T* end() {return pixels_.data() + pixels_.size();}
+        inline const T* begin() const {return pixels_.data();}
+        inline const T* end() const {return pixels_.data() + pixels_.size();}
+
+        bool operator == (const Framebuffer& f) const {
+            return width_ == f.width_ && height_ == f.height_ && std::equal(begin(), end(), f.begin());
+        }
+        bool operator != (const Framebuffer& f) const {return !(*this == f);}
+};
\ No newline at end of file
@@ -0,0 +1,163 @@
+/*
+Giacomo Arrigo 860022
+Marco Carfizzi 860149
+*/
+
+#include "pipeline.h"
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+
+// Output of a sequence of frames on a background thread, so that the pipeline renders the next frame while the
+// previous ones are encoded and written.
+// submit(pipeline) swaps the render of the pipeline with a blank buffer of the sequence and queues the frame; a writer
+// thread calls output(render, frame_number) on the queued frames in order, clears them and gives them back.
+// At most "capacity" frames wait in the queue: when it is full submit blocks until the writer catches up, so a slow
+// output slows the rendering down instead of making the memory grow.
+// Example:
+//     FrameSequence<char, Dynamic, Dynamic> frames([](Render<char, Dynamic, Dynamic>& r, size_t n){
+//         r.savePGM("frame" + std::to_string(n) + ".pgm");
+//     }, 1920, 1080);
+//     for (...){ pipeline.render(scene); frames.submit(pipeline); }
+//     frames.finish();
+template <typename target_t, size_t C, size_t R>
+class FrameSequence{
+    public:
+        using render_t = Render<target_t, C, R>;
+        using output_f = std::function<void(render_t&, size_t)>;
+
+    private:
+        struct Frame{
+            std::unique_ptr<render_t> render;
+            size_t number;
+        };
+
+        output_f output_;
+        size_t width_, height_, capacity_;
+        // Buffers are allocated when needed, up to capacity + 1 (the queued frames plus the one being written)
+        size_t allocated_ = 0;
+        std::deque<Frame> queue_;
+        std::vector<std::unique_ptr<render_t>> free_;
+        size_t submitted_ = 0, written_ = 0;
+        bool stopping_ = false;
+        std::exception_ptr error_;
+        std::mutex mutex_;
+        std::condition_variable frame_queued_, frame_written_;
+        std::thread writer_;
+
+        void writerLoop(){
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (true){
+                frame_queued_.wait(lock, [&]{return stopping_ || !queue_.empty();});
+                if (queue_.empty())
+                    return;
+                Frame frame = std::move(queue_.front());
+                queue_.pop_front();
+                // The output and the clear run without the lock, while the pipeline renders the next frames
+                // After a failure the frames are not output anymore, until the exception is re-thrown
+                const bool skip = error_ != nullptr;
+                lock.unlock();
+                std::exception_ptr error;
+                try{
+                    if (!skip)
+                        output_(*frame.render, frame.number);
+                }
+                catch (...){
+                    error = std::current_exception();
+                }
+                frame.render->clear_container();
+                lock.lock();
+                if (error && !error_)
+                    error_ = error;
+                free_.push_back(std::move(frame.render));
+                written_++;
+                frame_written_.notify_all();
+            }
+        }
+
+        // Re-throw (once) the first exception thrown by the output, with the lock held
+        void rethrow(){
+            if (error_){
+                std::exception_ptr error = error_;
+                error_ = nullptr;
+                // Frames queued after the failure are dropped
+                written_ += queue_.size();
+                for (Frame& frame : queue_){
+                    frame.render->clear_container();
+                    free_.push_back(std::move(frame.render));
+                }
+                queue_.clear();
+                std::rethrow_exception(error);
+            }
+        }
+
+    public:
+        // output is called on the writer thread for each frame; width and height are the resolution of the frames
+        // (they default to C and R, so they are only needed when the resolution is Dynamic, where 0 is rejected)
+        FrameSequence(output_f output, size_t width = C, size_t height = R, size_t capacity = 2) :
+            output_(std::move(output)), width_(width), height_(height), capacity_(std::max<size_t>(capacity, 1)){
+            if (width == 0 || height == 0)
+                throw std::invalid_argument("The resolution of the frames must not be 0");
+            writer_ = std::thread(&FrameSequence::writerLoop, this);
+        }
+
+        FrameSequence(const FrameSequence&) = delete;
+        FrameSequence& operator = (const FrameSequence&) = delete;
+
+        // Waits for the queued frames to be written; exceptions of the output are lost here, call finish to get them
+        ~FrameSequence(){
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            frame_queued_.notify_all();
+            writer_.join();
+        }
+
+        // Queue the frame currently held by the pipeline, which gets a blank buffer to draw the next one.
+        // Blocks while "capacity" frames are already waiting; re-throws an exception thrown by the output of an earlier frame.
+        template <typename pipeline_t>
+        FrameSequence& submit(pipeline_t& pipeline){
+            std::unique_ptr<render_t> buffer;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                frame_written_.wait(lock, [&]{return error_ || (queue_.size() < capacity_ && (!free_.empty() || allocated_ <= capacity_));});
+                rethrow();
+                if (!free_.empty()){
+                    buffer = std::move(free_.back());
+                    free_.pop_back();
+                }
+                else
+                    allocated_++;
+            }
+            if (!buffer)
+                buffer.reset(new render_t(width_, height_));
+            // The buffer coming back from the writer is blank, so the pipeline can skip clearing it
+            pipeline.swapRender(*buffer, true);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                queue_.push_back({std::move(buffer), submitted_++});
+            }
+            frame_queued_.notify_one();
+            return *this;
+        }
+
+        // Wait until every submitted frame has been written, re-throwing the first exception of the output
+        void finish(){
+            std::unique_lock<std::mutex> lock(mutex_);
+            frame_written_.wait(lock, [&]{return error_ || written_ == submitted_;});
+            rethrow();
+        }
+
+        // Number of frames submitted and number of frames whose output is complete
+        size_t submitted(){
+            std::lock_guard<std::mutex> lock(mutex_);
+            return submitted_;
+        }
+        size_t written(){
+            std::lock_guard<std::mutex> lock(mutex_);
+            return written_;
+        }
+};
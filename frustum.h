@@ -16,10 +16,10 @@ class ProjectionMatrix{
         ProjectionMatrix() = default;
 
         // Getters methods
-        double getLeft(){return left_;}
-        double getRight(){return right_;}
-        double getTop(){return top_;}
-        double getBottom(){return bottom_;}
-        double getNear(){return near_;}
-        double getFar(){return far_;}
+        double getLeft() const {return left_;}
+        double getRight() const {return right_;}
+        double getTop() const {return top_;}
+        double getBottom() const {return bottom_;}
+        double getNear() const {return near_;}
+        double getFar() const {return far_;}
 };
\ No newline at end of file
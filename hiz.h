@@ -0,0 +1,91 @@
+/*  
+Giacomo Arrigo 860022
+Marco Carfizzi 860149
+*/
+
+#include "multisample.h"
+
+// Coarse depth structure kept alongside the z-buffer: it stores an upper bound of the depth of each RASTER_BLOCK block
+// and of each RASTER_TILE tile, so that triangles and blocks lying entirely behind it are skipped before any per-pixel work.
+// The bounds only decrease while drawing: a block bound is lowered when a triangle covers the whole block,
+// a tile bound is the maximum of its blocks and is recomputed lazily when one of them changed.
+class HierarchicalZ{
+    private:
+        static constexpr long long BLOCKS_PER_TILE = RASTER_TILE / RASTER_BLOCK;
+        long long blocks_x_ = 0, blocks_y_ = 0, tiles_x_ = 0, tiles_y_ = 0;
+        std::vector<double> block_max_, tile_max_;
+        std::vector<char> tile_dirty_;
+
+        inline size_t tileOf(long long bx, long long by) const {return (by / BLOCKS_PER_TILE) * tiles_x_ + bx / BLOCKS_PER_TILE;}
+
+    public:
+        // Set up the structure for a screen of width x height pixels
+        void resize(long long width, long long height){
+            blocks_x_ = (width + RASTER_BLOCK - 1) / RASTER_BLOCK;
+            blocks_y_ = (height + RASTER_BLOCK - 1) / RASTER_BLOCK;
+            tiles_x_ = (width + RASTER_TILE - 1) / RASTER_TILE;
+            tiles_y_ = (height + RASTER_TILE - 1) / RASTER_TILE;
+            block_max_.resize(blocks_x_ * blocks_y_);
+            tile_max_.resize(tiles_x_ * tiles_y_);
+            tile_dirty_.resize(tiles_x_ * tiles_y_);
+        }
+
+        // Same as a z-buffer filled with +infinity
+        void clear(){
+            std::fill(block_max_.begin(), block_max_.end(), std::numeric_limits<double>::infinity());
+            std::fill(tile_max_.begin(), tile_max_.end(), std::numeric_limits<double>::infinity());
+            std::fill(tile_dirty_.begin(), tile_dirty_.end(), 0);
+        }
+
+        // True if a triangle whose depth is at least z_min can't pass the depth test anywhere in block (bx, by)
+        inline bool blockOccluded(long long bx, long long by, double z_min) const {
+            return block_max_[by * blocks_x_ + bx] <= z_min;
+        }
+
+        // Called when a triangle whose depth is at most z_max covered the whole block (bx, by):
+        // after its depth tests no pixel of the block is farther than z_max
+        inline void coverBlock(long long bx, long long by, double z_max){
+            double& bound = block_max_[by * blocks_x_ + bx];
+            if (z_max < bound){
+                bound = z_max;
+                tile_dirty_[tileOf(bx, by)] = 1;
+            }
+        }
+
+        // True if a triangle whose depth is at least z_min can't pass the depth test anywhere in the pixels [x0, x1] x [y0, y1]
+        // Only the tiles overlapping the rectangle are read, so workers checking their own tile don't interfere
+        bool rectOccluded(long long x0, long long y0, long long x1, long long y1, double z_min){
+            for (long long ty = y0 / RASTER_TILE; ty <= y1 / RASTER_TILE; ty++){
+                for (long long tx = x0 / RASTER_TILE; tx <= x1 / RASTER_TILE; tx++){
+                    size_t tile = ty * tiles_x_ + tx;
+                    if (tile_dirty_[tile]){
+                        double bound = 0;
+                        for (long long by = ty * BLOCKS_PER_TILE; by < std::min((ty + 1) * BLOCKS_PER_TILE, blocks_y_); by++)
+                            for (long long bx = tx * BLOCKS_PER_TILE; bx < std::min((tx + 1) * BLOCKS_PER_TILE, blocks_x_); bx++)
+                                bound = std::max(bound, block_max_[by * blocks_x_ + bx]);
+                        tile_max_[tile] = bound;
+                        tile_dirty_[tile] = 0;
+                    }
+                    if (tile_max_[tile] > z_min)
+                        return false;
+                }
+            }
+            return true;
+        }
+};
+
+// Conservative depth range of a triangle with vertex depths z[3]: the interpolated depth of its fragments is a weighted
+// harmonic mean of the vertex depths, so it stays between them up to rounding, which the small margin accounts for.
+// Triangles with a vertex on or in front of the near plane (depth <= 0) get an unbounded range, so they are never rejected
+// nor used as occluders.
+inline void triangleDepthRange(const double z[3], double& z_min, double& z_max){
+    if (!(z[0] > 0 && z[1] > 0 && z[2] > 0 && z[0] < std::numeric_limits<double>::infinity() &&
+          z[1] < std::numeric_limits<double>::infinity() && z[2] < std::numeric_limits<double>::infinity())){
+        z_min = -std::numeric_limits<double>::infinity();
+        z_max = std::numeric_limits<double>::infinity();
+        return;
+    }
+    const double margin = 16 * std::numeric_limits<double>::epsilon();
+    z_min = std::min({z[0], z[1], z[2]}) * (1 - margin);
+    z_max = std::max({z[0], z[1], z[2]}) * (1 + margin);
+}
\ No newline at end of file
@@ -0,0 +1,540 @@
+/*
+Giacomo Arrigo 860022
+Marco Carfizzi 860149
+*/
+
+#include "clip.h"
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <cctype>
+#if defined(__unix__) || defined(__APPLE__)
+#define PIPELINE3D_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* Loading and saving meshes as a Scene
+ *
+ * Binary mesh format (.p3dm), little endian, meant to be memory mapped:
+ *   char     magic[4]        "P3DM"
+ *   uint32   version         1
+ *   uint32   index_size      4 or 8 bytes per index
+ *   uint32   reserved        0
+ *   uint64   vertex_count
+ *   uint64   triangle_count
+ *   double   vertices[vertex_count][3]      x, y, z
+ *   uintN    triangles[triangle_count][3]   indices of the vertices, N = 8 * index_size
+ *
+ * Text formats (OBJ, PLY) are read MESH_CHUNK bytes at a time, and the vectors of the scene are reserved with their
+ * final size before being filled, so the memory used while loading stays close to the one of the resulting scene.
+ */
+
+constexpr size_t MESH_CHUNK = 1 << 20;
+constexpr uint32_t MESH_VERSION = 1;
+constexpr size_t MESH_HEADER_SIZE = 32;
+
+static_assert(sizeof(Vertex) == 3 * sizeof(double) && std::is_standard_layout<Vertex>::value,
+              "Vertex must be stored as its three coordinates");
+
+// Read-only view of a whole file: memory mapped where the system allows it, read in memory otherwise
+class MappedFile{
+    private:
+        const char* data_ = nullptr;
+        size_t size_ = 0;
+#ifdef PIPELINE3D_MMAP
+        void* map_ = nullptr;
+#else
+        std::vector<char> buffer_;
+#endif
+
+    public:
+        explicit MappedFile(const std::string& filename){
+#ifdef PIPELINE3D_MMAP
+            int fd = ::open(filename.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw std::runtime_error("Cannot open " + filename);
+            struct stat info;
+            if (::fstat(fd, &info) != 0){
+                ::close(fd);
+                throw std::runtime_error("Cannot read " + filename);
+            }
+            size_ = info.st_size;
+            if (size_ > 0){
+                map_ = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (map_ == MAP_FAILED){
+                    ::close(fd);
+                    throw std::runtime_error("Cannot map " + filename);
+                }
+                // The file is read once from start to end
+                ::madvise(map_, size_, MADV_SEQUENTIAL);
+                data_ = static_cast<const char*>(map_);
+            }
+            // The mapping stays valid after the descriptor is closed
+            ::close(fd);
+#else
+            std::ifstream in(filename, std::ios::binary | std::ios::ate);
+            if (!in)
+                throw std::runtime_error("Cannot open " + filename);
+            buffer_.resize(static_cast<size_t>(in.tellg()));
+            in.seekg(0);
+            in.read(buffer_.data(), buffer_.size());
+            data_ = buffer_.data();
+            size_ = buffer_.size();
+#endif
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator = (const MappedFile&) = delete;
+
+        ~MappedFile(){
+#ifdef PIPELINE3D_MMAP
+            if (map_)
+                ::munmap(map_, size_);
+#endif
+        }
+
+        inline const char* data() const {return data_;}
+        inline size_t size() const {return size_;}
+};
+
+// Reads a stream MESH_CHUNK bytes at a time, handing out contiguous pieces of it
+class ChunkReader{
+    private:
+        std::istream& in_;
+        std::vector<char> buffer_;
+        size_t begin_ = 0, end_ = 0;
+        bool eof_ = false;
+
+        // Move the unread bytes to the front of the buffer and read after them, so that at least "needed" bytes are unread
+        // (unless the stream ends). The buffer only grows when a single piece needs more than MESH_CHUNK bytes
+        void refill(size_t needed){
+            std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+            end_ -= begin_;
+            begin_ = 0;
+            if (needed + 1 > buffer_.size())
+                buffer_.resize(std::max(needed + 1, 2 * buffer_.size() - 1));
+            in_.read(buffer_.data() + end_, buffer_.size() - 1 - end_);
+            end_ += in_.gcount();
+            eof_ = !in_;
+            // Sentinel, so that number parsing stops at the end of the data
+            buffer_[end_] = '\0';
+        }
+
+    public:
+        explicit ChunkReader(std::istream& in) : in_(in), buffer_(MESH_CHUNK + 1){
+            buffer_[0] = '\0';
+        }
+
+        // Pointer to the next n bytes, which are consumed; throws if the stream ends before
+        const char* take(size_t n){
+            if (end_ - begin_ < n)
+                refill(n);
+            if (end_ - begin_ < n)
+                throw std::runtime_error("Unexpected end of mesh file");
+            const char* p = buffer_.data() + begin_;
+            begin_ += n;
+            return p;
+        }
+
+        // Next line (without the line break), false at the end of the stream. The line is followed by a character
+        // that is not part of a number, so it can be parsed in place
+        bool line(const char*& begin, const char*& end){
+            while (true){
+                const char* p = buffer_.data() + begin_;
+                const void* newline = std::memchr(p, '\n', end_ - begin_);
+                if (newline){
+                    begin = p;
+                    end = static_cast<const char*>(newline);
+                    begin_ = end - buffer_.data() + 1;
+                    return true;
+                }
+                if (eof_){
+                    if (begin_ == end_)
+                        return false;
+                    begin = p;
+                    end = buffer_.data() + end_;
+                    begin_ = end_;
+                    return true;
+                }
+                // The end of the line is not in the buffer yet: read more
+                refill(end_ - begin_ + 1);
+            }
+        }
+};
+
+inline bool meshSpace(char c){
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Parse a number starting at p (after spaces) in a line ending at end, advancing p past it
+inline bool parseMeshDouble(const char*& p, const char* end, double& value){
+    while (p < end && meshSpace(*p))
+        p++;
+    if (p >= end)
+        return false;
+    char* next;
+    value = std::strtod(p, &next);
+    if (next == p || next > end)
+        return false;
+    p = next;
+    return true;
+}
+
+inline bool parseMeshInteger(const char*& p, const char* end, long long& value){
+    while (p < end && meshSpace(*p))
+        p++;
+    if (p >= end)
+        return false;
+    char* next;
+    value = std::strtoll(p, &next, 10);
+    if (next == p || next > end)
+        return false;
+    p = next;
+    return true;
+}
+
+// Load a mesh in the binary format: the file is mapped and its vertices and triangles are copied straight
+// into the vectors of the scene, reserved with their final size
+inline Scene loadBinaryMesh(const std::string& filename){
+    MappedFile file(filename);
+    const char* data = file.data();
+    if (file.size() < MESH_HEADER_SIZE || std::memcmp(data, "P3DM", 4) != 0)
+        throw std::runtime_error(filename + " is not a binary mesh");
+    uint32_t version, index_size;
+    uint64_t vertex_count, triangle_count;
+    std::memcpy(&version, data + 4, 4);
+    std::memcpy(&index_size, data + 8, 4);
+    std::memcpy(&vertex_count, data + 16, 8);
+    std::memcpy(&triangle_count, data + 24, 8);
+    if (version != MESH_VERSION || (index_size != 4 && index_size != 8))
+        throw std::runtime_error(filename + " has an unsupported version or index size");
+    const uint64_t vertex_bytes = vertex_count * 3 * sizeof(double), index_bytes = triangle_count * 3 * index_size;
+    if (vertex_count > file.size() || triangle_count > file.size() ||
+        file.size() - MESH_HEADER_SIZE < vertex_bytes || file.size() - MESH_HEADER_SIZE - vertex_bytes < index_bytes)
+        throw std::runtime_error(filename + " is truncated");
+
+    std::vector<Vertex> vertices;
+    vertices.reserve(vertex_count);
+    const char* p = data + MESH_HEADER_SIZE;
+    for (uint64_t i = 0; i < vertex_count; i++, p += 3 * sizeof(double)){
+        double xyz[3];
+        std::memcpy(xyz, p, sizeof(xyz));
+        vertices.emplace_back(xyz[0], xyz[1], xyz[2]);
+    }
+
+    std::vector<Triangle> triangles(triangle_count);
+    for (uint64_t i = 0; i < triangle_count; i++){
+        for (size_t k = 0; k < 3; k++, p += index_size){
+            uint64_t index;
+            if (index_size == 4){
+                uint32_t index32;
+                std::memcpy(&index32, p, 4);
+                index = index32;
+            }
+            else
+                std::memcpy(&index, p, 8);
+            if (index >= vertex_count)
+                throw std::runtime_error(filename + " has a vertex index out of range");
+            triangles[i][k] = index;
+        }
+    }
+    return Scene(std::move(vertices), std::move(triangles));
+}
+
+// Save a scene in the binary format, using 32 bit indices when they are enough
+inline void saveBinaryMesh(const Scene& scene, const std::string& filename){
+    const std::vector<Vertex>& vertices = scene.getSceneVertices();
+    const std::vector<Triangle>& triangles = scene.getSceneTriangles();
+    const uint32_t version = MESH_VERSION, reserved = 0;
+    const uint32_t index_size = vertices.size() <= std::numeric_limits<uint32_t>::max() ? 4 : 8;
+    const uint64_t vertex_count = vertices.size(), triangle_count = triangles.size();
+
+    std::ofstream out(filename, std::ios::binary);
+    if (!out)
+        throw std::runtime_error("Cannot open " + filename);
+    out.write("P3DM", 4);
+    out.write(reinterpret_cast<const char*>(&version), 4);
+    out.write(reinterpret_cast<const char*>(&index_size), 4);
+    out.write(reinterpret_cast<const char*>(&reserved), 4);
+    out.write(reinterpret_cast<const char*>(&vertex_count), 8);
+    out.write(reinterpret_cast<const char*>(&triangle_count), 8);
+    // Vertex holds just its coordinates, so the vector is already in the file layout
+    out.write(reinterpret_cast<const char*>(vertices.data()), vertices.size() * sizeof(Vertex));
+    // Indices are converted a chunk at a time
+    std::vector<char> chunk;
+    chunk.reserve(MESH_CHUNK);
+    for (const Triangle& triangle : triangles){
+        for (size_t index : triangle){
+            char bytes[8];
+            if (index_size == 4){
+                uint32_t index32 = static_cast<uint32_t>(index);
+                std::memcpy(bytes, &index32, 4);
+            }
+            else {
+                uint64_t index64 = index;
+                std::memcpy(bytes, &index64, 8);
+            }
+            chunk.insert(chunk.end(), bytes, bytes + index_size);
+        }
+        if (chunk.size() + 3 * 8 > MESH_CHUNK){
+            out.write(chunk.data(), chunk.size());
+            chunk.clear();
+        }
+    }
+    out.write(chunk.data(), chunk.size());
+    if (!out)
+        throw std::runtime_error("Cannot write " + filename);
+}
+
+// Load the vertices and faces of a Wavefront OBJ file (other statements are ignored); polygons are split in fans of
+// triangles, and the vertex references may be negative (relative) and carry texture and normal indices, which are dropped.
+// The file is read twice: the first pass counts vertices and triangles to reserve the vectors.
+inline Scene loadObj(const std::string& filename){
+    std::ifstream in(filename, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("Cannot open " + filename);
+
+    auto statement = [](const char*& p, const char* end){
+        while (p < end && meshSpace(*p))
+            p++;
+        if (p + 1 < end && (p[0] == 'v' || p[0] == 'f') && meshSpace(p[1]))
+            return *p++;
+        return '\0';
+    };
+    auto skipToken = [](const char*& p, const char* end){
+        while (p < end && meshSpace(*p))
+            p++;
+        const char* start = p;
+        while (p < end && !meshSpace(*p))
+            p++;
+        return p != start;
+    };
+
+    size_t vertex_count = 0, triangle_count = 0;
+    {
+        ChunkReader reader(in);
+        const char *p, *end;
+        while (reader.line(p, end)){
+            char kind = statement(p, end);
+            if (kind == 'v')
+                vertex_count++;
+            else if (kind == 'f'){
+                size_t corners = 0;
+                while (skipToken(p, end))
+                    corners++;
+                if (corners >= 3)
+                    triangle_count += corners - 2;
+            }
+        }
+    }
+    in.clear();
+    in.seekg(0);
+
+    std::vector<Vertex> vertices;
+    std::vector<Triangle> triangles;
+    vertices.reserve(vertex_count);
+    triangles.reserve(triangle_count);
+    ChunkReader reader(in);
+    const char *p, *end;
+    while (reader.line(p, end)){
+        char kind = statement(p, end);
+        if (kind == 'v'){
+            double x, y, z;
+            if (!parseMeshDouble(p, end, x) || !parseMeshDouble(p, end, y) || !parseMeshDouble(p, end, z))
+                throw std::runtime_error(filename + " has a malformed vertex");
+            vertices.emplace_back(x, y, z);
+        }
+        else if (kind == 'f'){
+            size_t first = 0, previous = 0, corners = 0;
+            long long reference;
+            while (parseMeshInteger(p, end, reference)){
+                // Skip the "/texture/normal" part of the reference
+                while (p < end && !meshSpace(*p))
+                    p++;
+                long long index = reference < 0 ? (long long)vertices.size() + reference : reference - 1;
+                if (reference == 0 || index < 0)
+                    throw std::runtime_error(filename + " has a vertex index out of range");
+                if (corners == 0)
+                    first = index;
+                else if (corners >= 2)
+                    triangles.push_back({first, previous, (size_t)index});
+                previous = index;
+                corners++;
+            }
+        }
+    }
+    // References to vertices defined later in the file are allowed, so the range is checked at the end
+    for (const Triangle& triangle : triangles)
+        if (triangle[0] >= vertices.size() || triangle[1] >= vertices.size() || triangle[2] >= vertices.size())
+            throw std::runtime_error(filename + " has a vertex index out of range");
+    return Scene(std::move(vertices), std::move(triangles));
+}
+
+// Load the "vertex" (x, y, z properties) and "face" (vertex_indices list) elements of a PLY file, in ascii or binary
+// format; other elements and properties are skipped. Faces with more than three vertices are split in fans.
+inline Scene loadPly(const std::string& filename){
+    std::ifstream in(filename, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("Cannot open " + filename);
+
+    struct Property{
+        std::string name;
+        int type = 0, count_type = 0;
+        bool list = false;
+    };
+    struct Element{
+        std::string name;
+        size_t count = 0;
+        std::vector<Property> properties;
+    };
+    // Scalar types of the format, with their sizes in the binary encodings
+    static const char* const type_names[][2] = {{"char", "int8"}, {"uchar", "uint8"}, {"short", "int16"}, {"ushort", "uint16"},
+                                                {"int", "int32"}, {"uint", "uint32"}, {"float", "float32"}, {"double", "float64"}};
+    static const size_t type_sizes[] = {1, 1, 2, 2, 4, 4, 4, 8};
+    auto typeOf = [&](const std::string& name){
+        for (int t = 0; t < 8; t++)
+            if (name == type_names[t][0] || name == type_names[t][1])
+                return t;
+        throw std::runtime_error(filename + " has an unknown property type " + name);
+    };
+
+    // Header, read line by line
+    std::string line, format;
+    std::vector<Element> elements;
+    if (!std::getline(in, line) || line.compare(0, 3, "ply") != 0)
+        throw std::runtime_error(filename + " is not a PLY file");
+    while (std::getline(in, line)){
+        std::istringstream words(line);
+        std::string word;
+        words >> word;
+        if (word == "format")
+            words >> format;
+        else if (word == "element"){
+            elements.emplace_back();
+            words >> elements.back().name >> elements.back().count;
+        }
+        else if (word == "property"){
+            if (elements.empty())
+                throw std::runtime_error(filename + " has a property outside of an element");
+            Property property;
+            std::string type;
+            words >> type;
+            if (type == "list"){
+                std::string count_type;
+                words >> count_type >> type;
+                property.list = true;
+                property.count_type = typeOf(count_type);
+            }
+            property.type = typeOf(type);
+            words >> property.name;
+            elements.back().properties.push_back(property);
+        }
+        else if (word == "end_header")
+            break;
+    }
+    const bool ascii = format == "ascii";
+    if (!ascii && format != "binary_little_endian" && format != "binary_big_endian")
+        throw std::runtime_error(filename + " has an unsupported format " + format);
+    uint16_t probe = 1;
+    const bool host_little = *reinterpret_cast<const unsigned char*>(&probe) == 1;
+    const bool swap = !ascii && (format == "binary_little_endian") != host_little;
+
+    size_t vertex_count = 0, triangle_count = 0;
+    for (const Element& element : elements)
+        if (element.name == "vertex")
+            vertex_count = element.count;
+    std::vector<Vertex> vertices;
+    std::vector<Triangle> triangles;
+    vertices.reserve(vertex_count);
+
+    ChunkReader reader(in);
+    // In the ascii format each element is on its own line, which is parsed in place
+    const char *line_p = nullptr, *line_end = nullptr;
+    // Next value of the given type, as a double
+    auto value = [&](int type){
+        if (ascii){
+            double v;
+            if (!parseMeshDouble(line_p, line_end, v))
+                throw std::runtime_error(filename + " has a malformed element");
+            return v;
+        }
+        unsigned char bytes[8];
+        std::memcpy(bytes, reader.take(type_sizes[type]), type_sizes[type]);
+        if (swap)
+            std::reverse(bytes, bytes + type_sizes[type]);
+        switch (type){
+            case 0: {int8_t v; std::memcpy(&v, bytes, 1); return (double)v;}
+            case 1: {uint8_t v; std::memcpy(&v, bytes, 1); return (double)v;}
+            case 2: {int16_t v; std::memcpy(&v, bytes, 2); return (double)v;}
+            case 3: {uint16_t v; std::memcpy(&v, bytes, 2); return (double)v;}
+            case 4: {int32_t v; std::memcpy(&v, bytes, 4); return (double)v;}
+            case 5: {uint32_t v; std::memcpy(&v, bytes, 4); return (double)v;}
+            case 6: {float v; std::memcpy(&v, bytes, 4); return (double)v;}
+            default: {double v; std::memcpy(&v, bytes, 8); return v;}
+        }
+    };
+
+    std::vector<size_t> face;
+    for (const Element& element : elements){
+        const bool is_vertex = element.name == "vertex", is_face = element.name == "face";
+        // The face count is known, triangles are reserved assuming they are triangles and grow only for larger polygons
+        if (is_face){
+            triangle_count = element.count;
+            triangles.reserve(triangle_count);
+        }
+        for (size_t i = 0; i < element.count; i++){
+            if (ascii && !reader.line(line_p, line_end))
+                throw std::runtime_error("Unexpected end of mesh file");
+            double xyz[3] = {0, 0, 0};
+            for (const Property& property : element.properties){
+                if (property.list){
+                    size_t n = (size_t)value(property.count_type);
+                    const bool indices = is_face && (property.name == "vertex_indices" || property.name == "vertex_index");
+                    face.clear();
+                    for (size_t k = 0; k < n; k++){
+                        double index = value(property.type);
+                        if (indices){
+                            if (!(index >= 0 && index < vertex_count))
+                                throw std::runtime_error(filename + " has a vertex index out of range");
+                            face.push_back((size_t)index);
+                        }
+                    }
+                    for (size_t k = 1; indices && k + 1 < face.size(); k++)
+                        triangles.push_back({face[0], face[k], face[k + 1]});
+                    continue;
+                }
+                double v = value(property.type);
+                if (is_vertex){
+                    if (property.name == "x") xyz[0] = v;
+                    else if (property.name == "y") xyz[1] = v;
+                    else if (property.name == "z") xyz[2] = v;
+                }
+            }
+            if (is_vertex)
+                vertices.emplace_back(xyz[0], xyz[1], xyz[2]);
+        }
+    }
+    return Scene(std::move(vertices), std::move(triangles));
+}
+
+// Load a mesh choosing the parser by the extension of the file: .obj, .ply, anything else is read as the binary format
+inline Scene loadMesh(const std::string& filename){
+    auto endsWith = [&](const char* extension){
+        size_t n = std::strlen(extension);
+        if (filename.size() < n)
+            return false;
+        for (size_t i = 0; i < n; i++)
+            if (std::tolower((unsigned char)filename[filename.size() - n + i]) != extension[i])
+                return false;
+        return true;
+    };
+    if (endsWith(".obj"))
+        return loadObj(filename);
+    if (endsWith(".ply"))
+        return loadPly(filename);
+    return loadBinaryMesh(filename);
+}
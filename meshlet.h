@@ -0,0 +1,250 @@
+/*
+Giacomo Arrigo 860022
+Marco Carfizzi 860149
+*/
+
+#include "mesh.h"
+#include <numeric>
+
+/* Mesh preprocessing, meant to run once after loading a mesh (or offline, saving the result with saveBinaryMesh)
+ *
+ * optimizeMesh reorders the triangles so that neighbours in the array are neighbours on the surface, groups them into
+ * meshlets of at most MESHLET_VERTICES vertices and MESHLET_TRIANGLES triangles, and renumbers the vertices in the order
+ * the triangles first use them (dropping the unused ones). The pipeline then reads the vertices almost sequentially,
+ * and can reject a whole meshlet with a single test of its bounding sphere and normal cone.
+ */
+
+constexpr size_t MESHLET_VERTICES = 64;
+constexpr size_t MESHLET_TRIANGLES = 124;
+
+// Interleaves the lower 21 bits of x, y and z (Morton order), so that points close in space get close codes
+inline unsigned long long mortonCode(unsigned long long x, unsigned long long y, unsigned long long z){
+    auto spread = [](unsigned long long v){
+        v &= 0x1fffff;
+        v = (v | v << 32) & 0x1f00000000ffffULL;
+        v = (v | v << 16) & 0x1f0000ff0000ffULL;
+        v = (v | v << 8) & 0x100f00f00f00f00fULL;
+        v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+        v = (v | v << 2) & 0x1249249249249249ULL;
+        return v;
+    };
+    return spread(x) | spread(y) << 1 | spread(z) << 2;
+}
+
+// Coordinate i (0 for x, 1 for y, 2 for z) of a vertex
+inline double vertexCoordinate(const Vertex& v, int i){
+    return i == 0 ? v.getX() : i == 1 ? v.getY() : v.getZ();
+}
+
+// Bounding sphere and normal cone of the triangles [first, first + count) of a scene
+inline Meshlet meshletBounds(const Scene& scene, size_t first, size_t count){
+    const std::vector<Vertex>& vertices = scene.getSceneVertices();
+    const std::vector<Triangle>& triangles = scene.getSceneTriangles();
+    Meshlet m = {first, count, {0, 0, 0}, 0, {0, 0, 0}, -1};
+
+    // Sphere centered in the middle of the bounding box
+    double lo[3] = {INFINITY, INFINITY, INFINITY}, hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+    for (size_t t = first; t < first + count; t++)
+        for (size_t k = 0; k < 3; k++){
+            const Vertex& v = vertices[triangles[t][k]];
+            for (int i = 0; i < 3; i++){
+                lo[i] = std::min(lo[i], vertexCoordinate(v, i));
+                hi[i] = std::max(hi[i], vertexCoordinate(v, i));
+            }
+        }
+    if (count == 0)
+        return m;
+    for (int i = 0; i < 3; i++)
+        m.center[i] = (lo[i] + hi[i]) / 2;
+    double radius2 = 0;
+    for (size_t t = first; t < first + count; t++)
+        for (size_t k = 0; k < 3; k++){
+            const Vertex& v = vertices[triangles[t][k]];
+            double dx = v.getX() - m.center[0], dy = v.getY() - m.center[1], dz = v.getZ() - m.center[2];
+            radius2 = std::max(radius2, dx * dx + dy * dy + dz * dz);
+        }
+    m.radius = std::sqrt(radius2);
+
+    // The axis of the cone is the average of the unit normals, the half angle reaches the farthest one.
+    // Degenerate triangles have no normal and can't be culled by their winding anyway, so they are left out
+    std::vector<std::array<double, 3>> normals;
+    normals.reserve(count);
+    double axis[3] = {0, 0, 0};
+    for (size_t t = first; t < first + count; t++){
+        const Vertex& a = vertices[triangles[t][0]];
+        const Vertex& b = vertices[triangles[t][1]];
+        const Vertex& c = vertices[triangles[t][2]];
+        const double u[3] = {b.getX() - a.getX(), b.getY() - a.getY(), b.getZ() - a.getZ()};
+        const double v[3] = {c.getX() - a.getX(), c.getY() - a.getY(), c.getZ() - a.getZ()};
+        std::array<double, 3> n = {{u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0]}};
+        double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (!(length > 0))
+            continue;
+        for (int i = 0; i < 3; i++){
+            n[i] /= length;
+            axis[i] += n[i];
+        }
+        normals.push_back(n);
+    }
+    double length = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    if (!(length > 0))
+        return m;
+    double cutoff = 1;
+    for (int i = 0; i < 3; i++)
+        m.cone_axis[i] = axis[i] / length;
+    for (const std::array<double, 3>& n : normals)
+        cutoff = std::min(cutoff, n[0] * m.cone_axis[0] + n[1] * m.cone_axis[1] + n[2] * m.cone_axis[2]);
+    m.cone_cutoff = cutoff;
+    return m;
+}
+
+// Returns a copy of the scene optimized for rendering, with its meshlets set (see the comment at the top of the file).
+// The triangles keep their winding and the vertices their attributes; only the order of both changes.
+// Triangles are first sorted along a Morton curve through their centroids. Meshlets then grow from the first unused
+// triangle by adding, among the unused triangles sharing a vertex with the last one added, the one bringing the fewest
+// new vertices; when there is none the next one along the curve is taken.
+inline Scene optimizeMesh(const Scene& scene, size_t max_vertices = MESHLET_VERTICES, size_t max_triangles = MESHLET_TRIANGLES){
+    const std::vector<Vertex>& vertices = scene.getSceneVertices();
+    const std::vector<Triangle>& triangles = scene.getSceneTriangles();
+    const size_t vertex_count = vertices.size(), triangle_count = triangles.size();
+    max_vertices = std::max<size_t>(max_vertices, 3);
+    max_triangles = std::max<size_t>(max_triangles, 1);
+    for (const Triangle& t : triangles)
+        if (t[0] >= vertex_count || t[1] >= vertex_count || t[2] >= vertex_count)
+            throw std::out_of_range("Vertex out of range");
+
+    // Morton order of the centroids, quantized on a 2^21 grid over the bounding box of the mesh
+    double lo[3] = {INFINITY, INFINITY, INFINITY}, hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+    for (const Vertex& v : vertices)
+        for (int i = 0; i < 3; i++){
+            lo[i] = std::min(lo[i], vertexCoordinate(v, i));
+            hi[i] = std::max(hi[i], vertexCoordinate(v, i));
+        }
+    std::vector<unsigned long long> code(triangle_count);
+    for (size_t t = 0; t < triangle_count; t++){
+        unsigned long long q[3];
+        for (int i = 0; i < 3; i++){
+            double c = (vertexCoordinate(vertices[triangles[t][0]], i) + vertexCoordinate(vertices[triangles[t][1]], i) +
+                        vertexCoordinate(vertices[triangles[t][2]], i)) / 3;
+            double extent = hi[i] - lo[i];
+            double unit = extent > 0 ? (c - lo[i]) / extent : 0;
+            q[i] = (unsigned long long)(std::min(std::max(unit, 0.0), 1.0) * 0x1fffff);
+        }
+        code[t] = mortonCode(q[0], q[1], q[2]);
+    }
+    std::vector<size_t> curve(triangle_count);
+    std::iota(curve.begin(), curve.end(), 0);
+    std::stable_sort(curve.begin(), curve.end(), [&](size_t a, size_t b){return code[a] < code[b];});
+
+    // Triangles using each vertex (compressed adjacency lists)
+    std::vector<size_t> adjacency_start(vertex_count + 1, 0), adjacency(3 * triangle_count);
+    for (const Triangle& t : triangles)
+        for (size_t k = 0; k < 3; k++)
+            adjacency_start[t[k] + 1]++;
+    std::partial_sum(adjacency_start.begin(), adjacency_start.end(), adjacency_start.begin());
+    {
+        std::vector<size_t> fill(adjacency_start.begin(), adjacency_start.end() - 1);
+        for (size_t t = 0; t < triangle_count; t++)
+            for (size_t k = 0; k < 3; k++)
+                adjacency[fill[triangles[t][k]]++] = t;
+    }
+
+    // Greedy meshlets. in_meshlet[v] holds the index + 1 of the last meshlet that used vertex v.
+    // Used triangles are swapped out of the adjacency lists as they are met, [adjacency_start[v], adjacency_end[v])
+    // keeps the ones that may still be unused, so vertices shared by many triangles are not scanned over and over
+    std::vector<size_t> adjacency_end(adjacency_start.begin() + 1, adjacency_start.end());
+    std::vector<char> used(triangle_count, 0);
+    std::vector<size_t> in_meshlet(vertex_count, 0), order;
+    order.reserve(triangle_count);
+    std::vector<size_t> meshlet_ends;
+    size_t curve_next = 0, meshlet_vertices = 0, meshlet_triangles = 0;
+    auto newVertices = [&](size_t t){
+        size_t n = 0;
+        for (size_t k = 0; k < 3; k++)
+            n += in_meshlet[triangles[t][k]] != meshlet_ends.size() + 1;
+        return n;
+    };
+    while (order.size() < triangle_count){
+        // Candidate: the best unused neighbour of the last triangle of the meshlet, or the next one along the curve
+        size_t best = triangle_count, best_score = 4;
+        if (meshlet_triangles > 0){
+            const Triangle& last = triangles[order.back()];
+            for (size_t k = 0; k < 3; k++)
+                for (size_t a = adjacency_start[last[k]]; a < adjacency_end[last[k]]; a++){
+                    size_t t = adjacency[a];
+                    if (used[t]){
+                        adjacency[a--] = adjacency[--adjacency_end[last[k]]];
+                        continue;
+                    }
+                    size_t score = newVertices(t);
+                    if (score < best_score){
+                        best = t;
+                        best_score = score;
+                    }
+                }
+        }
+        if (best == triangle_count){
+            while (used[curve[curve_next]])
+                curve_next++;
+            best = curve[curve_next];
+            best_score = newVertices(best);
+        }
+        // Close the meshlet when the triangle doesn't fit, the triangle then starts the next one
+        if (meshlet_triangles > 0 && (meshlet_vertices + best_score > max_vertices || meshlet_triangles == max_triangles)){
+            meshlet_ends.push_back(order.size());
+            meshlet_vertices = meshlet_triangles = 0;
+        }
+        for (size_t k = 0; k < 3; k++){
+            size_t v = triangles[best][k];
+            if (in_meshlet[v] != meshlet_ends.size() + 1){
+                in_meshlet[v] = meshlet_ends.size() + 1;
+                meshlet_vertices++;
+            }
+        }
+        used[best] = 1;
+        order.push_back(best);
+        meshlet_triangles++;
+    }
+    if (meshlet_triangles > 0)
+        meshlet_ends.push_back(order.size());
+
+    // Vertices renumbered by first use, unused ones are dropped
+    const size_t unassigned = std::numeric_limits<size_t>::max();
+    std::vector<size_t> remap(vertex_count, unassigned), source;
+    source.reserve(vertex_count);
+    std::vector<Triangle> new_triangles;
+    new_triangles.reserve(triangle_count);
+    for (size_t t : order){
+        Triangle triangle;
+        for (size_t k = 0; k < 3; k++){
+            size_t& v = remap[triangles[t][k]];
+            if (v == unassigned){
+                v = source.size();
+                source.push_back(triangles[t][k]);
+            }
+            triangle[k] = v;
+        }
+        new_triangles.push_back(triangle);
+    }
+    std::vector<Vertex> new_vertices;
+    new_vertices.reserve(source.size());
+    for (size_t v : source)
+        new_vertices.emplace_back(vertices[v]);
+    std::array<std::vector<double>, ATTRIBUTE_CHANNELS> channels;
+    for (size_t c = 0; c < ATTRIBUTE_CHANNELS; c++){
+        if (!(scene.getAttributeLayout() & channelAttribute(c)))
+            continue;
+        const std::vector<double>& values = scene.getAttributeChannel(c);
+        channels[c].reserve(source.size());
+        for (size_t v : source)
+            channels[c].push_back(values[v]);
+    }
+
+    Scene result(std::move(new_vertices), std::move(new_triangles), scene.getAttributeLayout(), std::move(channels));
+    std::vector<Meshlet> meshlets;
+    meshlets.reserve(meshlet_ends.size());
+    for (size_t m = 0, first = 0; m < meshlet_ends.size(); first = meshlet_ends[m++])
+        meshlets.push_back(meshletBounds(result, first, meshlet_ends[m] - first));
+    result.setMeshlets(std::move(meshlets));
+    return result;
+}
@@ -0,0 +1,193 @@
+/*
+Giacomo Arrigo 860022
+Marco Carfizzi 860149
+*/
+
+#include "precision.h"
+
+// Sample positions are given on a grid of SAMPLE_GRID x SAMPLE_GRID steps per pixel, around the point where the
+// rasterizer samples the pixel (its center, or its integer coordinates when the vertices are snapped to whole pixels)
+constexpr long long SAMPLE_GRID = 16;
+constexpr size_t MAX_SAMPLES = 8;
+
+// Positions of the samples of a pixel used by the multisample anti-aliasing, in SAMPLE_GRID steps from the pixel.
+// The standard patterns are rotated grids: no two samples share a row or a column, so nearly horizontal and nearly
+// vertical edges get as many coverage levels as there are samples
+struct SamplePattern{
+    size_t count;
+    long long dx[MAX_SAMPLES], dy[MAX_SAMPLES];
+
+    // Pattern with 1, 2, 4 or 8 samples
+    static SamplePattern standard(size_t samples){
+        switch (samples){
+            case 1: return {1, {0}, {0}};
+            case 2: return {2, {4, -4}, {4, -4}};
+            case 4: return {4, {-2, 6, -6, 2}, {-6, -2, 2, 6}};
+            case 8: return {8, {1, -1, 5, -3, -5, -7, 3, 7}, {-3, 3, 1, -5, 5, -1, 7, -7}};
+            default: throw std::invalid_argument("The number of samples must be 1, 2, 4 or 8");
+        }
+    }
+};
+
+// Replace the bounding box of a setup, made by TriangleSetup::init from the same vertices, with the pixels whose
+// samples of the pattern are inside the box of the triangle
+inline void sampleBounds(const long long x[3], const long long y[3], int subpixel_bits, const SamplePattern& pattern, TriangleSetup& t){
+    // Pixel p samples the fixed point coordinate (p * one + half) * SAMPLE_GRID + d * one, in SAMPLE_GRID steps
+    const long long one = 1LL << subpixel_bits, half = subpixel_bits > 0 ? one / 2 : 0;
+    const long long dx_min = *std::min_element(pattern.dx, pattern.dx + pattern.count), dx_max = *std::max_element(pattern.dx, pattern.dx + pattern.count);
+    const long long dy_min = *std::min_element(pattern.dy, pattern.dy + pattern.count), dy_max = *std::max_element(pattern.dy, pattern.dy + pattern.count);
+    const long long step = one * SAMPLE_GRID;
+    t.x_min = ceilDiv((std::min({x[0], x[1], x[2]}) - half) * SAMPLE_GRID - dx_max * one, step);
+    t.x_max = floorDiv((std::max({x[0], x[1], x[2]}) - half) * SAMPLE_GRID - dx_min * one, step);
+    t.y_min = ceilDiv((std::min({y[0], y[1], y[2]}) - half) * SAMPLE_GRID - dy_max * one, step);
+    t.y_max = floorDiv((std::max({y[0], y[1], y[2]}) - half) * SAMPLE_GRID - dy_min * one, step);
+}
+
+// Edge equations of a triangle at the samples of a pattern. Sample weights are kept multiplied by SAMPLE_GRID, so they
+// stay exact integers: the value of edge k at sample s of pixel (x, y) is v + offset[k][s], with v = SAMPLE_GRID *
+// edge[k](x, y), and the sample is on the inner side of the edge (top-left rule included) when v >= threshold[k][s]
+struct SampleEdges{
+    long long offset[3][MAX_SAMPLES], threshold[3][MAX_SAMPLES];
+    // Every sample of a pixel is inside edge k when v >= all_inside[k], none of them when v < any_inside[k]
+    long long all_inside[3], any_inside[3];
+
+    SampleEdges(const TriangleSetup& t, const SamplePattern& pattern){
+        for (int k = 0; k < 3; k++){
+            all_inside[k] = std::numeric_limits<long long>::min();
+            any_inside[k] = std::numeric_limits<long long>::max();
+            for (size_t s = 0; s < pattern.count; s++){
+                offset[k][s] = t.edge[k].a * pattern.dx[s] + t.edge[k].b * pattern.dy[s];
+                threshold[k][s] = t.edge[k].min_inside - offset[k][s];
+                all_inside[k] = std::max(all_inside[k], threshold[k][s]);
+                any_inside[k] = std::min(any_inside[k], threshold[k][s]);
+            }
+        }
+    }
+};
+
+// Walks the pixels of a triangle inside the rectangle [x0, x1] x [y0, y1] (inclusive) like rasterizeTriangle, testing
+// the samples of the pattern instead of the pixel itself: fragment(x, y, v0, v1, v2, mask) is called for each pixel
+// with at least one covered sample, where vi is the weight of vertex i at the pixel multiplied by SAMPLE_GRID and bit s
+// of mask is set when sample s is covered. block(bx, by, covered) is called as in rasterizeTriangle, covered meaning
+// that every sample of the walked pixels is covered. The bounding box of the setup must include the pixels whose
+// samples may be covered (see sampleBounds).
+// Pixels far from the edges get their mask from three comparisons, only the ones an edge crosses test every sample.
+// Samples is the number of samples of the pattern, a template argument so that the loops over them are unrolled.
+template <size_t Samples, typename block_f, typename fragment_f>
+void rasterizeSamples(const TriangleSetup& t, const SampleEdges& samples,
+                      long long x0, long long y0, long long x1, long long y1, block_f&& block, fragment_f&& fragment){
+    const long long clip_x0 = x0, clip_y0 = y0, clip_x1 = x1, clip_y1 = y1;
+    x0 = std::max(x0, t.x_min);
+    x1 = std::min(x1, t.x_max);
+    y0 = std::max(y0, t.y_min);
+    y1 = std::min(y1, t.y_max);
+    if (x0 > x1 || y0 > y1)
+        return;
+    static_assert(Samples > 0 && Samples <= MAX_SAMPLES, "Unsupported number of samples");
+    const unsigned full = (1u << Samples) - 1;
+    const long long step_x[3] = {t.edge[0].a * SAMPLE_GRID, t.edge[1].a * SAMPLE_GRID, t.edge[2].a * SAMPLE_GRID};
+    const long long step_y[3] = {t.edge[0].b * SAMPLE_GRID, t.edge[1].b * SAMPLE_GRID, t.edge[2].b * SAMPLE_GRID};
+
+    for (long long by = y0 - y0 % RASTER_BLOCK; by <= y1; by += RASTER_BLOCK){
+        long long py0 = std::max(by, y0), py1 = std::min(by + RASTER_BLOCK - 1, y1);
+
+        for (long long bx = x0 - x0 % RASTER_BLOCK; bx <= x1; bx += RASTER_BLOCK){
+            long long px0 = std::max(bx, x0), px1 = std::min(bx + RASTER_BLOCK - 1, x1);
+
+            // Extremes of the edge functions over the pixels of the block, compared with the thresholds of the samples
+            bool outside = false, inside = true;
+            for (int k = 0; k < 3; k++){
+                long long corner = t.edge[k](px0, py0) * SAMPLE_GRID;
+                long long dx = step_x[k] * (px1 - px0), dy = step_y[k] * (py1 - py0);
+                if (corner + std::max(dx, 0LL) + std::max(dy, 0LL) < samples.any_inside[k]){
+                    outside = true;
+                    break;
+                }
+                inside = inside && corner + std::min(dx, 0LL) + std::min(dy, 0LL) >= samples.all_inside[k];
+            }
+            if (outside)
+                continue;
+
+            bool covered = inside && px0 == std::max(bx, clip_x0) && px1 == std::min(bx + RASTER_BLOCK - 1, clip_x1) &&
+                           py0 == std::max(by, clip_y0) && py1 == std::min(by + RASTER_BLOCK - 1, clip_y1);
+            if (!block(bx / RASTER_BLOCK, by / RASTER_BLOCK, covered))
+                continue;
+
+            long long v0_row = t.edge[0](px0, py0) * SAMPLE_GRID, v1_row = t.edge[1](px0, py0) * SAMPLE_GRID;
+            long long v2_row = t.edge[2](px0, py0) * SAMPLE_GRID;
+            for (long long y = py0; y <= py1; y++){
+                long long v0 = v0_row, v1 = v1_row, v2 = v2_row;
+                for (long long x = px0; x <= px1; x++){
+                    unsigned mask = full;
+                    if (!inside && !(v0 >= samples.all_inside[0] && v1 >= samples.all_inside[1] && v2 >= samples.all_inside[2])){
+                        mask = 0;
+                        if (v0 >= samples.any_inside[0] && v1 >= samples.any_inside[1] && v2 >= samples.any_inside[2]){
+                            for (size_t s = 0; s < Samples; s++)
+                                mask |= (unsigned)((v0 >= samples.threshold[0][s]) & (v1 >= samples.threshold[1][s]) &
+                                                   (v2 >= samples.threshold[2][s])) << s;
+                        }
+                    }
+                    if (mask)
+                        fragment(x, y, v0, v1, v2, mask);
+                    v0 += step_x[0];
+                    v1 += step_x[1];
+                    v2 += step_x[2];
+                }
+                v0_row += step_y[0];
+                v1_row += step_y[1];
+                v2_row += step_y[2];
+            }
+        }
+    }
+}
+
+// Format of the depth of the samples: the reciprocal of the depth in 32 bit float, negated so that nearer samples have
+// smaller values. It's the value of the depth plane of FragmentInterpolator before its division, which is affine in
+// the weights, so the depth of a sample is found from the one of its pixel with an addition.
+// A buffer with several samples per pixel stays as compact as a FloatDepth z-buffer per sample.
+struct SampleDepth{
+    using storage_t = float;
+    static constexpr storage_t cleared(){return std::numeric_limits<float>::infinity();}
+    // inverse_depth is 1 / z, NaN is never stored
+    static inline storage_t encode(double inverse_depth){return -(storage_t)inverse_depth;}
+};
+
+// Resolve of the samples of a pixel into its final value: bit s of covered is set when sample s was written by a
+// triangle, the other samples still hold the background. Pixels of arithmetic types wider than a byte (numbers, grey
+// levels) get the average of their covered samples, or the background when less than half of them are covered, so an
+// edge never gets a value blended with the background that no triangle shaded. The other ones, characters included,
+// get the most frequent sample, ties going to the first one of the pattern. It can be specialized for other pixel
+// types (e.g. an RGB color).
+template <typename T, typename = void>
+struct SampleResolve{
+    static T resolve(const T* samples, unsigned, size_t count, T){
+        size_t best = 0, best_count = 0;
+        for (size_t s = 0; s < count && best_count * 2 <= count; s++){
+            size_t n = 0;
+            for (size_t r = s; r < count; r++)
+                n += samples[r] == samples[s] ? 1 : 0;
+            if (n > best_count){
+                best = s;
+                best_count = n;
+            }
+        }
+        return samples[best];
+    }
+};
+
+template <typename T>
+struct SampleResolve<T, typename std::enable_if<std::is_arithmetic<T>::value && (sizeof(T) > 1)>::type>{
+    static T resolve(const T* samples, unsigned covered, size_t count, T background){
+        double sum = 0;
+        size_t n = 0;
+        for (size_t s = 0; s < count; s++){
+            if (covered >> s & 1u){
+                sum += samples[s];
+                n++;
+            }
+        }
+        if (n * 2 < count)
+            return background;
+        return std::is_integral<T>::value ? (T)std::llround(sum / n) : (T)(sum / n);
+    }
+};
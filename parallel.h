@@ -0,0 +1,136 @@
+/*  
+Giacomo Arrigo 860022
+Marco Carfizzi 860149
+*/
+
+#include "hiz.h"
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+
+// Returns the number of threads to use when the user asks for "as many as possible" (0)
+inline size_t resolveThreadCount(size_t threads){
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    return std::max<size_t>(threads, 1);
+}
+
+// Threads shared by every parallelFor of the process, started the first time they are needed and kept waiting for
+// work on a condition variable, so a parallel pass of a frame doesn't pay for creating and joining its threads.
+// A task asks for a number of helpers: idle threads join it until it has them, and the thread that submitted it works
+// on it too. The submitter never waits for a helper to start, only for the ones that joined to finish, so a task
+// submitted while every thread is busy (or from inside a job) still completes, with fewer workers.
+class WorkerPool{
+    public:
+        struct Task{
+            // Called by each worker with its id, 0 being the submitter
+            std::function<void(size_t)> body;
+            // Helpers still wanted, next id to hand out and helpers running the body
+            size_t wanted, next_id = 1, running = 0;
+        };
+
+    private:
+        std::mutex mutex_;
+        std::condition_variable task_queued_, task_left_;
+        std::deque<Task*> queue_;
+        std::vector<std::thread> threads_;
+        bool stopping_ = false;
+
+        WorkerPool() = default;
+
+        void workerLoop(){
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (true){
+                task_queued_.wait(lock, [&]{return stopping_ || !queue_.empty();});
+                if (stopping_)
+                    return;
+                Task* task = queue_.front();
+                const size_t id = task->next_id++;
+                if (--task->wanted == 0)
+                    queue_.pop_front();
+                task->running++;
+                lock.unlock();
+                task->body(id);
+                lock.lock();
+                if (--task->running == 0)
+                    task_left_.notify_all();
+            }
+        }
+
+    public:
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator = (const WorkerPool&) = delete;
+
+        ~WorkerPool(){
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            task_queued_.notify_all();
+            for (std::thread& t : threads_)
+                t.join();
+        }
+
+        static WorkerPool& instance(){
+            static WorkerPool pool;
+            return pool;
+        }
+
+        // Runs task.body(0) on the calling thread and on up to task.wanted threads of the pool (ids 1, 2, ...) and
+        // returns when all of them returned. The pool grows to task.wanted threads if it has fewer.
+        void run(Task& task){
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                while (threads_.size() < task.wanted)
+                    threads_.emplace_back(&WorkerPool::workerLoop, this);
+                queue_.push_back(&task);
+            }
+            task_queued_.notify_all();
+            task.body(0);
+            // Helpers that did not start yet are not needed anymore, the submitter waits for the others
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (task.wanted > 0)
+                queue_.erase(std::find(queue_.begin(), queue_.end(), &task));
+            task_left_.wait(lock, [&]{return task.running == 0;});
+        }
+};
+
+// Calls job(i, worker) for each i in [0, count) using up to "threads" workers: the calling thread and threads of the
+// WorkerPool, each with its own id in [0, threads). Work is handed out dynamically through a shared counter, so a
+// worker that finishes early takes the next item instead of staying idle. The first exception thrown by a job is
+// re-thrown in the calling thread once all workers stopped.
+template <typename job_f>
+void parallelFor(size_t threads, size_t count, job_f&& job){
+    threads = std::min(resolveThreadCount(threads), count);
+    if (threads <= 1){
+        for (size_t i = 0; i < count; i++)
+            job(i, 0);
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    std::exception_ptr error;
+
+    WorkerPool::Task task;
+    task.wanted = threads - 1;
+    task.body = [&](size_t worker_id){
+        try{
+            for (size_t i = next++; i < count && !failed; i = next++)
+                job(i, worker_id);
+        }
+        catch (...){
+            // Only the first failing worker stores its exception, the others stop at their next item
+            if (!failed.exchange(true))
+                error = std::current_exception();
+        }
+    };
+    WorkerPool::instance().run(task);
+
+    if (error)
+        std::rethrow_exception(error);
+}
@@ -3,171 +3,981 @@ Giacomo Arrigo 860022
 Marco Carfizzi 860149
 */
 
-#include "shader.h"
+#include "profile.h"
 
 
 // Context of the strategy pattern, the actual pipeline
 // The pipeline contains the computations and data needed to represent an object in a 2D space, such as the screen or a file
-template <typename target_t, size_t C, size_t R>
+// shader_t is the type of the fragment shader: the default interface allows swapping shaders at runtime,
+// a concrete (final) shader type lets the compiler inline it in the raster loop
+// precision_t (see PrecisionPolicy) selects the subpixel precision of the vertices, the type used to interpolate
+// the fragments and the format of the z-buffer
+template <typename target_t, size_t C, size_t R, typename shader_t = IFragmentShader<target_t>, typename precision_t = DoublePrecision>
 class Pipeline{
     private:
+        using real_t = typename precision_t::real_t;
+        using depth_t = typename precision_t::depth_t;
+        using depth_storage_t = typename depth_t::storage_t;
+
         Render<target_t, C, R> video_;
         ProjectionMatrix pm_;
-        IFragmentShader<target_t> *fs_;
-        Render<double, C, R> z_buffer_;
-        std::array<double, 3> scalars;
+        shader_t *fs_;
+        // The z-buffer is always allocated on the heap and stored in 8x8 tiles, matching the blocks walked by the rasterizer
+        Framebuffer<depth_storage_t, TiledLayout<RASTER_BLOCK>> z_buffer_;
+        // Number of threads used by render, 1 keeps the whole frame on the calling thread
+        size_t threads_ = 1;
+        // Structure of arrays copies of the scene vertices and of their ndc coordinates, reused between frames
+        VertexBuffer positions_, ndc_;
+        // Revision of the scene whose vertices are in ndc_ and model transform they were placed with, the buffers are
+        // rebuilt only when the scene, the model transform or the projection changes
+        unsigned long long ndc_revision_ = 0;
+        ModelTransform model_;
+        bool ndc_valid_ = false;
+        // Channels of the vertex attributes interpolated for the shader, the ones of the scene that shader_t::attributes
+        // asks for: values of the vertices of ndc_ (clipped ones included), with the normals placed by the model transform
+        unsigned attribute_layout_ = ATTRIBUTES_NONE;
+        std::array<std::vector<double>, ATTRIBUTE_CHANNELS> attributes_;
+        // Triangles left after culling and clipping (indices in ndc_), rebuilt when ndc_ or the cull mode change
+        std::vector<Triangle> assembled_;
+        // Outcodes of the vertices of the scene against the clip planes, OUTCODE_PENDING for the ones not computed yet
+        std::vector<unsigned> outcodes_;
+        CullMode cull_ = CullMode::None;
+        bool assembly_valid_ = false;
+        // Coarse depth bounds used to skip hidden triangles and blocks before the per-pixel depth test
+        HierarchicalZ hiz_;
+        // Optional front-to-back drawing order, cached like the ndc coordinates since it only depends on them
+        bool depth_sort_ = false;
+        std::vector<size_t> order_;
+        bool order_valid_ = false;
+        // Buffers of the multithreaded and deferred modes, kept between frames to reuse their memory
+        std::vector<RasterTriangle> raster_triangles_;
+        std::vector<std::vector<size_t>> bins_;
+        // Deferred shading: the rasterizer only keeps, for each pixel, the index in raster_triangles_ of the triangle
+        // that passed the depth test (stored like the z-buffer and valid where the depth is not cleared), then
+        // shadeVisibility calls the fragment shader once per visible pixel
+        bool deferred_ = false;
+        Framebuffer<uint32_t, TiledLayout<RASTER_BLOCK>> visibility_;
+        // Multisample anti-aliasing (see setMultisample): depth and color of every sample, pattern_.count consecutive
+        // values per pixel with the pixels in the tiled order of the z-buffer, resolved into video_ at the end of the frame
+        using sample_storage_t = SampleDepth::storage_t;
+        SamplePattern pattern_ = SamplePattern::standard(1);
+        TiledLayout<RASTER_BLOCK> sample_layout_;
+        AlignedBuffer<sample_storage_t> sample_depth_;
+        AlignedBuffer<target_t> sample_color_;
+        // Stage timings and statistics, updated only when PIPELINE3D_PROFILE / PIPELINE3D_STATS are defined
+        PipelineProfile profile_;
+        AssemblyCounts assembly_counts_;
+        // With PIPELINE3D_STATS, number of triangles covering each pixel in the last frame (row by row)
+        std::vector<unsigned> overdraw_;
+        // Lazy clears, tracked per RASTER_BLOCK block. A block of the z-buffer whose generation differs from frame_ counts
+        // as empty (depth_t::cleared()) and is reset only when a triangle first enters it, so clearing the z-buffer is just
+        // incrementing frame_. video_dirty_ marks the blocks of video_ drawn since they were last cleared: only those are
+        // blanked at the next render. video_unknown_ is set when video_ is handed out, since it may be written from outside.
+        long long blocks_x_ = 0;
+        std::vector<unsigned> z_generation_;
+        unsigned frame_ = 0;
+        std::vector<char> video_dirty_;
+        bool video_unknown_ = true;
+
+        // Start a new frame: the z-buffer is cleared by moving to a new generation, the video only where it was drawn
+        void clear_buffers_(){
+            if (++frame_ == 0){
+                // Generation counter wrapped around, every block gets a generation older than the current one
+                std::fill(z_generation_.begin(), z_generation_.end(), 0u);
+                frame_ = 1;
+            }
+            hiz_.clear();
+
+            if (video_unknown_){
+                video_.clear_container();
+                std::fill(video_dirty_.begin(), video_dirty_.end(), 0);
+                video_unknown_ = false;
+                return;
+            }
+            for (size_t b = 0; b < video_dirty_.size(); b++){
+                if (!video_dirty_[b])
+                    continue;
+                long long x0 = (b % blocks_x_) * RASTER_BLOCK, y0 = (b / blocks_x_) * RASTER_BLOCK;
+                long long x1 = std::min(x0 + RASTER_BLOCK, width()), y1 = std::min(y0 + RASTER_BLOCK, height());
+                for (long long y = y0; y < y1; y++)
+                    std::fill(&video_.pixel(x0, y), &video_.pixel(x0, y) + (x1 - x0), (target_t)(' '));
+                video_dirty_[b] = 0;
+            }
+        }
 
-        // Sets the z_buffer container to infinity values
-        inline void clear_z_buffer_(){
-            for (int i = 0; i < R; i++){
-                for (int j = 0; j < C; j++)
-                    z_buffer_(j, i) = std::numeric_limits<double>::infinity();
+        // Called before the pixels of block (bx, by) are written: the z-buffer block is reset if it's from an older frame
+        // and the video block is marked for the next clear. Blocks belong to a single tile, so workers never share them
+        inline void touchBlock(long long bx, long long by){
+            size_t b = by * blocks_x_ + bx;
+            if (z_generation_[b] != frame_){
+                // With the tiled layout the pixels of a block are contiguous, starting from its top left one
+                if (pattern_.count > 1){
+                    const size_t first = sample_layout_.index(bx * RASTER_BLOCK, by * RASTER_BLOCK) * pattern_.count;
+                    const size_t count = RASTER_BLOCK * RASTER_BLOCK * pattern_.count;
+                    std::fill(&sample_depth_[first], &sample_depth_[first] + count, SampleDepth::cleared());
+                    std::fill(&sample_color_[first], &sample_color_[first] + count, (target_t)(' '));
+                }
+                else {
+                    depth_storage_t* block = &z_buffer_(bx * RASTER_BLOCK, by * RASTER_BLOCK);
+                    std::fill(block, block + RASTER_BLOCK * RASTER_BLOCK, depth_t::cleared());
+                }
+                z_generation_[b] = frame_;
             }
+            video_dirty_[b] = 1;
         }
 
+        // Resolution of the screen, constants when C and R are given as template arguments
+        inline long long width() const {return video_.getWidth();}
+        inline long long height() const {return video_.getHeight();}
+
         // Convert a point coordinate from ndc to screen space to be printable
-        inline size_t x_to_screen(double x){return floor(((x - pm_.getLeft()) * C / (pm_.getRight() - pm_.getLeft())));}
-        inline size_t y_to_screen(double y){return floor(((y - pm_.getTop()) * R / (pm_.getBottom() - pm_.getTop())));}
-
-        // Apply the perspective projection and overwrite the ndc values to the old coordinates
-        void computeNdc(std::vector<Vertex>& vertices){
-            double x_, y_, z_, w_;
-            for (Vertex& vertex : vertices){
-                // compute the matrix * vector multiplication
-                x_ = vertex.getX() * ((2*pm_.getNear())/(pm_.getRight()-pm_.getLeft())) + (vertex.getZ() * (-(pm_.getRight()+pm_.getLeft())/(pm_.getRight()-pm_.getLeft())));
-                y_ = vertex.getY() * ((2*pm_.getNear())/(pm_.getBottom()-pm_.getTop())) + vertex.getZ() * ((-(pm_.getBottom()+pm_.getTop()))/(pm_.getBottom()-pm_.getTop()));
-                z_ = vertex.getZ() * ((pm_.getFar()+pm_.getNear())/(pm_.getFar()-pm_.getNear())) + ((-2*pm_.getNear()*pm_.getFar())/(pm_.getFar()-pm_.getNear()));
-                w_ = vertex.getZ();
-                
-                // normalize for w and replace original coordinates since they aren't needed anymore
-                vertex.setNdx(x_/w_);
-                vertex.setNdy(y_/w_);
-                // z needs to be "traslated" from (-1, 1) to (0,2) and divided by 2 to get it in (0, 1). Needed for the z interpolation 
-                vertex.setNdz((z_/w_ + 1)*0.5f);
-            }
-        }
-
-        // Compute the area of a triangle given the coordinates of 3 vertices
-        inline double area(double x1, double y1, double x2, double y2, double x3, double y3) { 
-            return std::abs((x1*(y2-y3) + x2*(y3-y1)+ x3*(y1-y2))/2.0); 
-        } 
-
-        // Check if a point (x, y) is inside triangle t
-        // P = (x,y), A = (x1, y1), B = (x2, y2), C = (x3, y3)
-        bool isInside(double x, double y, double x1, double x2, double x3, double y1, double y2, double y3){
-
-            // Calculate area of triangle ABC
-            double A = area (x1, y1, x2, y2, x3, y3); 
-            
-            // Calculate area of triangle PBC
-            double A1 = area (x, y, x2, y2, x3, y3); 
-            
-            // Calculate area of triangle PAC   
-            double A2 = area (x1, y1, x, y, x3, y3); 
-            
-            // Calculate area of triangle PAB    
-            double A3 = area (x1, y1, x2, y2, x, y); 
-                
-            /* Check if sum of A1, A2 and A3 is same as A:
-            if the point is inside the triangle, the areas of the triangles having (x, y) as third vertex will be partitions of the initial triangle,
-            therefore the sum will be equal to the total area.
-            If the point is outside, the sum of the areas will be greater than the initial triangle's area  */
-            return (A == A1 + A2 + A3); 
+        inline double x_to_screen_exact(double x){return ((x - pm_.getLeft()) * width() / (pm_.getRight() - pm_.getLeft()));}
+        inline double y_to_screen_exact(double y){return ((y - pm_.getTop()) * height() / (pm_.getBottom() - pm_.getTop()));}
+        // Fixed point screen coordinates with the subpixel bits of the precision policy (whole pixels by default)
+        inline long long x_to_screen(double x){return precision_t::toFixed(x_to_screen_exact(x));}
+        inline long long y_to_screen(double y){return precision_t::toFixed(y_to_screen_exact(y));}
+
+        // Place every vertex of the scene with model_ and apply the perspective projection, storing the ndc coordinates in ndc_
+        // The projection matrix is expanded once, then vertices are transformed in SIMD batches (split among the threads)
+        void computeNdc(const std::vector<Vertex>& vertices){
+            const ProjectionCoefficients coefficients(pm_);
+            const size_t count = vertices.size(), chunk = 16384;
+            const bool identity = model_.isIdentity();
+            positions_.resize(count);
+            ndc_.resize(count);
+            parallelFor(threads_, (count + chunk - 1) / chunk, [&](size_t c, size_t){
+                size_t begin = c * chunk, end = std::min(count, begin + chunk);
+                if (identity)
+                    gatherVertices(vertices, positions_, begin, end);
+                else
+                    gatherVertices(vertices, model_, positions_, begin, end);
+                transformVertices(coefficients, positions_, ndc_, begin, end);
+            });
+        }
+
+        // Copy the attribute channels of the scene used by the shader in attributes_. Normals go through the inverse
+        // transpose of the model transform, so that they stay orthogonal to the transformed surface
+        void gatherAttributes(const Scene& scene){
+            attribute_layout_ = scene.getAttributeLayout() & shader_t::attributes;
+            const size_t count = scene.getSceneVertices().size();
+            for (size_t c = 0; c < ATTRIBUTE_CHANNELS; c++){
+                if (!(attribute_layout_ & channelAttribute(c))){
+                    attributes_[c].clear();
+                    continue;
+                }
+                const std::vector<double>& channel = scene.getAttributeChannel(c);
+                if (channel.size() != count)
+                    throw std::out_of_range("Attribute values differ in number from the vertices");
+                attributes_[c].assign(channel.begin(), channel.end());
+            }
+            if ((attribute_layout_ & ATTRIBUTE_NORMAL) && !model_.isIdentity()){
+                const ModelTransform normal = model_.normalTransform();
+                std::vector<double>& an = attributes_[CHANNEL_NORMAL];
+                std::vector<double>& bn = attributes_[CHANNEL_NORMAL + 1];
+                std::vector<double>& cn = attributes_[CHANNEL_NORMAL + 2];
+                for (size_t i = 0; i < count; i++)
+                    normal.apply(an[i], bn[i], cn[i], an[i], bn[i], cn[i]);
+            }
+        }
+
+        // Channels interpolated for the shader: known at compile time to be off for the attributes shader_t doesn't read
+        inline bool interpolated(size_t channel) const {
+            return (shader_t::attributes & channelAttribute(channel)) && (attribute_layout_ & channelAttribute(channel));
+        }
+
+        // Interpolator of a triangle with the planes of the interpolated attributes
+        FragmentInterpolator<real_t> interpolator(const RasterTriangle& t, long long weight_scale = 1) const {
+            FragmentInterpolator<real_t> f(t, weight_scale);
+            for (size_t c = 0; c < ATTRIBUTE_CHANNELS; c++){
+                if (!interpolated(c))
+                    continue;
+                const double a[3] = {attributes_[c][t.vertex[0]], attributes_[c][t.vertex[1]], attributes_[c][t.vertex[2]]};
+                f.setAttribute(c, a);
+            }
+            return f;
+        }
+
+        // True if the triangle has to be discarded because of its winding on the screen
+        bool culled(const Triangle& triangle){
+            if (cull_ == CullMode::None)
+                return false;
+            double x[3], y[3];
+            for (size_t k = 0; k < 3; k++){
+                x[k] = x_to_screen_exact(ndc_.x[triangle[k]]);
+                y[k] = y_to_screen_exact(ndc_.y[triangle[k]]);
+            }
+            // With the y axis pointing down a positive cross product means a clockwise triangle
+            double cross = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+            return cull_ == CullMode::Clockwise ? cross > 0 : cross < 0;
+        }
+
+        // Primitive assembly, between computeNdc and the rasterization: triangles entirely outside one of the planes of the
+        // frustum are discarded, the ones crossing the near plane (or so large they leave the guard band) are clipped,
+        // and the ones facing away are culled according to cull_. The result keeps the submission order and goes in assembled_;
+        // the vertices created by clipping are appended to ndc_ after the ones of the scene.
+        void assemblePrimitives(const Scene& scene){
+            const std::vector<Triangle>& triangles = scene.getSceneTriangles();
+            const size_t vertex_count = scene.getSceneVertices().size(), chunk = 16384;
+            const ProjectionCoefficients coefficients(pm_);
+            const ClipPlanes planes(pm_, coefficients);
+
+            ndc_.resize(vertex_count);
+            positions_.resize(vertex_count);
+            for (size_t c = 0; c < ATTRIBUTE_CHANNELS; c++)
+                if (interpolated(c))
+                    attributes_[c].resize(vertex_count);
+            outcodes_.resize(vertex_count);
+
+            assembled_.clear();
+            assembly_counts_ = AssemblyCounts();
+            const std::vector<Meshlet>& meshlets = scene.getMeshlets();
+            if (meshlets.empty()){
+                parallelFor(threads_, (vertex_count + chunk - 1) / chunk, [&](size_t c, size_t){
+                    for (size_t i = c * chunk; i < std::min(vertex_count, (c + 1) * chunk); i++)
+                        outcodes_[i] = planes.outcode({positions_.x[i], positions_.y[i], positions_.z[i]});
+                });
+                for (const Triangle& triangle : triangles)
+                    assembleTriangle(triangle, vertex_count, coefficients, planes);
+                return;
+            }
+
+            // Meshlets entirely outside the frustum or facing away are skipped with all their triangles. Every triangle
+            // of a rejected meshlet would have been discarded on its own (degenerate ones, which cover no pixel, apart),
+            // so the picture is the same as without meshlets; the statistics count them as outside or as culled.
+            // The outcodes are computed when the triangles of the surviving meshlets reach their vertices, so the
+            // vertices used only by rejected meshlets are never classified.
+            // The bounds are in the space of the scene, they are placed with the model transform; the normal cone is only
+            // used when the transform preserves angles
+            const double scale = model_.similarityScale();
+            double radius_scale = scale;
+            if (scale == 0){
+                // The Frobenius norm of the 3x3 part bounds how much any transform stretches a distance
+                for (int r = 0; r < 3; r++)
+                    for (int c = 0; c < 3; c++)
+                        radius_scale += model_.m[r][c] * model_.m[r][c];
+                radius_scale = std::sqrt(radius_scale);
+            }
+            const ModelTransform normal = model_.normalTransform();
+            // A triangle is clockwise on the screen when its normal points away from the eye, dot(n, p) > 0 for its points
+            const double facing = (model_.determinant() < 0 ? -1 : 1) * (cull_ == CullMode::Clockwise ? 1 : -1);
+            const double pi = std::acos(-1.0);
+            std::fill(outcodes_.begin(), outcodes_.end(), OUTCODE_PENDING);
+            for (const Meshlet& m : meshlets){
+                ViewPoint center;
+                model_.apply(m.center[0], m.center[1], m.center[2], center.x, center.y, center.z);
+                const double radius = m.radius * radius_scale;
+                if (planes.sphereOutside(center, radius)){
+                    if (STATS_ENABLED){
+                        assembly_counts_.outside += m.triangle_count;
+                        assembly_counts_.meshlets_rejected++;
+                    }
+                    continue;
+                }
+                if (cull_ != CullMode::None && scale > 0 && m.cone_cutoff > 0){
+                    double axis[3];
+                    normal.apply(m.cone_axis[0], m.cone_axis[1], m.cone_axis[2], axis[0], axis[1], axis[2]);
+                    const double axis_length = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+                    const double distance = std::sqrt(center.x * center.x + center.y * center.y + center.z * center.z);
+                    if (distance > radius && axis_length > 0){
+                        // Every normal is within alpha of the axis, every direction from the eye to the meshlet within
+                        // beta of the one to the center, which is theta away from the axis: the meshlet is culled when
+                        // all the normals point away from the eye by some margin, theta + alpha + beta < 90 degrees
+                        const double cos_theta = facing * (axis[0] * center.x + axis[1] * center.y + axis[2] * center.z) / (axis_length * distance);
+                        const double theta = std::acos(std::max(-1.0, std::min(1.0, cos_theta)));
+                        const double alpha = std::acos(std::min(1.0, m.cone_cutoff));
+                        const double beta = std::asin(radius / distance);
+                        if (theta + alpha + beta < pi / 2 - 1e-6){
+                            if (STATS_ENABLED){
+                                assembly_counts_.culled += m.triangle_count;
+                                assembly_counts_.meshlets_rejected++;
+                            }
+                            continue;
+                        }
+                    }
+                }
+                for (size_t t = m.first_triangle; t < m.first_triangle + m.triangle_count; t++)
+                    assembleTriangle(triangles[t], vertex_count, coefficients, planes);
+            }
+        }
+
+        // Outcode of a vertex of the scene, computed the first time it's asked when it's still OUTCODE_PENDING
+        unsigned outcode(size_t i, const ClipPlanes& planes){
+            if (outcodes_[i] == OUTCODE_PENDING)
+                outcodes_[i] = planes.outcode({positions_.x[i], positions_.y[i], positions_.z[i]});
+            return outcodes_[i];
+        }
+
+        // Discard, clip and cull a triangle of the scene, adding what is left of it to assembled_
+        void assembleTriangle(const Triangle& triangle, size_t vertex_count, const ProjectionCoefficients& coefficients, const ClipPlanes& planes){
+            if (triangle[0] >= vertex_count || triangle[1] >= vertex_count || triangle[2] >= vertex_count)
+                throw std::out_of_range("Vertex out of range");
+            unsigned c0 = outcode(triangle[0], planes), c1 = outcode(triangle[1], planes), c2 = outcode(triangle[2], planes);
+            // Trivial rejection: all the vertices are outside the same plane, or one of them is not a valid point
+            if ((c0 & c1 & c2 & CLIP_FRUSTUM) || ((c0 | c1 | c2) & CLIP_INVALID)){
+                if (STATS_ENABLED)
+                    assembly_counts_.outside++;
+                return;
+            }
+            unsigned clip_mask = (c0 | c1 | c2) & CLIP_NEEDED;
+            if (!clip_mask){
+                if (!culled(triangle))
+                    assembled_.push_back(triangle);
+                else if (STATS_ENABLED)
+                    assembly_counts_.culled++;
+                return;
+            }
+            if (STATS_ENABLED)
+                assembly_counts_.clipped++;
+
+            // Each clipping plane adds at most one vertex to the polygon
+            ViewPoint polygon[16], tmp[16];
+            for (size_t k = 0; k < 3; k++)
+                polygon[k] = {positions_.x[triangle[k]], positions_.y[triangle[k]], positions_.z[triangle[k]], {k == 0 ? 1.0 : 0.0, k == 1 ? 1.0 : 0.0, k == 2 ? 1.0 : 0.0}};
+            size_t n = planes.clip(clip_mask, polygon, 3, tmp);
+            if (n < 3){
+                if (STATS_ENABLED)
+                    assembly_counts_.outside++;
+                return;
+            }
+            size_t first = ndc_.size();
+            for (size_t k = 0; k < n; k++){
+                double ndx, ndy, ndz;
+                projectVertex(coefficients, polygon[k].x, polygon[k].y, polygon[k].z, ndx, ndy, ndz);
+                ndc_.push_back(ndx, ndy, ndz);
+                // The view space position is kept as well, its depth is the w of the perspective interpolation
+                positions_.push_back(polygon[k].x, polygon[k].y, polygon[k].z);
+                // The attributes are linear in the scene space, like the position
+                for (size_t c = 0; c < ATTRIBUTE_CHANNELS; c++){
+                    if (!interpolated(c))
+                        continue;
+                    const double* b = polygon[k].b;
+                    double value = b[0] * attributes_[c][triangle[0]] + b[1] * attributes_[c][triangle[1]] + b[2] * attributes_[c][triangle[2]];
+                    attributes_[c].push_back(value);
+                }
+            }
+            // The clipped polygon is convex, split it in a fan of triangles with the same winding
+            for (size_t k = 1; k + 1 < n; k++){
+                Triangle piece = {first, first + k, first + k + 1};
+                if (!culled(piece))
+                    assembled_.push_back(piece);
+                else if (STATS_ENABLED)
+                    assembly_counts_.culled++;
+            }
+        }
+
+        // Project the vertices of a triangle on the screen and set up its edge equations
+        // Returns false if the triangle doesn't cover any pixel
+        bool prepareTriangle(const Triangle& triangle, RasterTriangle& t){
+            long long sx[3], sy[3];
+            for (size_t k = 0; k < 3; k++){
+                t.ndx[k] = ndc_.x[triangle[k]];
+                t.ndy[k] = ndc_.y[triangle[k]];
+                t.ndz[k] = ndc_.z[triangle[k]];
+                t.w[k] = positions_.z[triangle[k]];
+                t.vertex[k] = triangle[k];
+                sx[k] = x_to_screen(t.ndx[k]);
+                sy[k] = y_to_screen(t.ndy[k]);
+            }
+            triangleDepthRange(t.ndz, t.z_min, t.z_max);
+            if (!t.setup.init(sx, sy, precision_t::subpixel_bits))
+                return false;
+            // With multisampling the samples of the pixels around the box may be covered as well
+            if (pattern_.count > 1)
+                sampleBounds(sx, sy, precision_t::subpixel_bits, pattern_, t.setup);
+            return true;
+        }
+
+        // Sort the triangles by their nearest vertex, so that the hierarchical z-buffer gets the occluders first
+        // The sort is stable, triangles at the same depth keep their submission order
+        void sortTriangles(){
+            std::vector<double> key(assembled_.size());
+            for (size_t i = 0; i < assembled_.size(); i++){
+                const Triangle& triangle = assembled_[i];
+                double z = std::min({ndc_.z[triangle[0]], ndc_.z[triangle[1]], ndc_.z[triangle[2]]});
+                key[i] = std::isnan(z) ? std::numeric_limits<double>::infinity() : z;
+            }
+            order_.resize(assembled_.size());
+            for (size_t i = 0; i < order_.size(); i++)
+                order_[i] = i;
+            std::stable_sort(order_.begin(), order_.end(), [&](size_t a, size_t b){return key[a] < key[b];});
+        }
+
+        // Shade the fragments collected in the batch
+        inline void flushBatch(FragmentBatch<target_t>& batch){
+            flushBatch(batch, [&batch](size_t i, const target_t& value){*batch.pixel[i] = value;});
+        }
+        // Same, handing the results to store(i, value)
+        template <typename store_f>
+        inline void flushBatch(FragmentBatch<target_t>& batch, store_f&& store){
+            if (PROFILE_ENABLED)
+                profile_.fragments.add(batch.count);
+            StageTimer timer(profile_.shading);
+            batch.flush(fs_, attribute_layout_ & shader_t::attributes, store);
+        }
+
+        // Index of the i-th triangle to draw
+        inline size_t drawOrder(size_t i) const {return depth_sort_ ? order_[i] : i;}
+
+        // Whole triangle rejection, using the tile bounds of the hierarchical z-buffer
+        bool triangleOccluded(const RasterTriangle& t, long long x0, long long y0, long long x1, long long y1, RasterCounts& counts){
+            if (!hiz_.rectOccluded(std::max({x0, t.setup.x_min, 0LL}), std::max({y0, t.setup.y_min, 0LL}),
+                                   std::min({x1, t.setup.x_max, width() - 1}), std::min({y1, t.setup.y_max, height() - 1}), t.z_min))
+                return false;
+            if (STATS_ENABLED){
+                counts.triangles_occluded++;
+                profile_.add(counts);
+            }
+            return true;
+        }
+
+        // Block callback of the rasterizers (see rasterizeTriangle) for a triangle drawn in [x0, x1] x [y0, y1].
+        // Block rejection: blocks whose depth bound is in front of the triangle are skipped,
+        // blocks entirely covered by the triangle get its farthest depth as new bound
+        auto blockVisitor(const RasterTriangle& t, long long x0, long long y0, long long x1, long long y1, RasterCounts& counts){
+            return [this, &t, x0, y0, x1, y1, &counts](long long bx, long long by, bool covered){
+                if (hiz_.blockOccluded(bx, by, t.z_min)){
+                    if (STATS_ENABLED)
+                        counts.blocks_occluded++;
+                    return false;
+                }
+                if (covered)
+                    hiz_.coverBlock(bx, by, t.z_max);
+                touchBlock(bx, by);
+                if (STATS_ENABLED){
+                    // Pixels of the block inside both the rectangle and the bounding box of the triangle
+                    long long px0 = std::max({bx * RASTER_BLOCK, x0, t.setup.x_min}), px1 = std::min({bx * RASTER_BLOCK + RASTER_BLOCK - 1, x1, t.setup.x_max});
+                    long long py0 = std::max({by * RASTER_BLOCK, y0, t.setup.y_min}), py1 = std::min({by * RASTER_BLOCK + RASTER_BLOCK - 1, y1, t.setup.y_max});
+                    counts.pixels_tested += (px1 - px0 + 1) * (py1 - py0 + 1);
+                }
+                return true;
+            };
+        }
+
+        // Rasterize a triangle restricted to the rectangle [x0, x1] x [y0, y1]
+        // With Deferred the fragments are not shaded, the pixels they win keep the index "id" of the triangle instead
+        template <bool Deferred>
+        void rasterize(const RasterTriangle& t, uint32_t id, long long x0, long long y0, long long x1, long long y1){
+            // Statistics of this call, added to the pipeline counters at the end (only with PIPELINE3D_STATS)
+            RasterCounts counts;
+            if (triangleOccluded(t, x0, y0, x1, y1, counts))
+                return;
+            auto block = blockVisitor(t, x0, y0, x1, y1, counts);
+
+            const FragmentInterpolator<real_t> f = interpolator(t);
+            // Fragments passing the depth test are shaded in batches once the batch is full and at the end of the triangle.
+            // Each pixel is covered at most once by a triangle, so delaying the color write doesn't change the result
+            FragmentBatch<target_t> batch;
+            rasterizeTriangle(t.setup, x0, y0, x1, y1, block, [&](long long x, long long y, long long w0, long long w1, long long){
+                const real_t z_interp = f.depth(w0, w1);
+
+                if (STATS_ENABLED){
+                    counts.pixels_covered++;
+                    overdraw_[y * width() + x]++;
+                }
+                // update z_buff and queue the interpolated vertex of the fragment for the fragmentshader (it returns a target_t),
+                // or just record the triangle in the visibility buffer when the shading is deferred
+                depth_storage_t& depth = z_buffer_(x, y);
+                const depth_storage_t encoded = depth_t::encode(z_interp);
+                if (depth > encoded){
+                    depth = encoded;
+                    if (Deferred)
+                        visibility_(x, y) = id;
+                    else {
+                        const real_t q = f.perspective(w0, w1);
+                        const size_t i = batch.push(f.x(w0, w1, q), f.y(w0, w1, q), z_interp, &video_.pixel(x, y));
+                        for (size_t c = 0; c < ATTRIBUTE_CHANNELS; c++)
+                            if (interpolated(c))
+                                batch.attribute[c][i] = f.attribute(c, w0, w1, q);
+                        if (batch.full())
+                            flushBatch(batch);
+                    }
+                    if (STATS_ENABLED)
+                        counts.depth_passed++;
+                }
+                else if (STATS_ENABLED)
+                    counts.depth_failed++;
+            });
+            if (!Deferred)
+                flushBatch(batch);
+            if (STATS_ENABLED)
+                profile_.add(counts);
+        }
+
+        // Rasterize a triangle with multisampling, restricted to the rectangle [x0, x1] x [y0, y1]. Every covered sample
+        // is depth tested on its own; where some of them pass, the fragment shader is called once for the pixel and its
+        // result is stored in those samples. The pixel is shaded at its center when the triangle covers all its samples,
+        // at its first covered sample otherwise, so the attributes are never extrapolated outside the triangle.
+        template <size_t Samples>
+        void rasterizeMultisample(const RasterTriangle& t, long long x0, long long y0, long long x1, long long y1){
+            RasterCounts counts;
+            if (triangleOccluded(t, x0, y0, x1, y1, counts))
+                return;
+            auto block = blockVisitor(t, x0, y0, x1, y1, counts);
+
+            // The weights given by rasterizeSamples are multiplied by SAMPLE_GRID
+            const FragmentInterpolator<real_t> f = interpolator(t, SAMPLE_GRID);
+            const SampleEdges samples(t.setup, pattern_);
+            const size_t n = Samples;
+            const unsigned full = (1u << Samples) - 1;
+            // The reciprocal of the depth is affine in the weights: each sample has a constant offset from its pixel
+            real_t depth_offset[MAX_SAMPLES];
+            for (size_t s = 0; s < n; s++)
+                depth_offset[s] = samples.offset[0][s] * f.depth_plane.d0 + samples.offset[1][s] * f.depth_plane.d1;
+            // The batch points to the first sample of each pixel, masks tells which of them receive the color
+            FragmentBatch<target_t> batch;
+            unsigned masks[SHADE_BATCH];
+            // Masks along the edges are irregular, the samples are selected without branches
+            auto store = [&](size_t i, const target_t& value){
+                target_t* pixel = batch.pixel[i];
+                for (size_t s = 0; s < n; s++)
+                    pixel[s] = (masks[i] >> s) & 1u ? value : pixel[s];
+            };
+            rasterizeSamples<Samples>(t.setup, samples, x0, y0, x1, y1, block, [&](long long x, long long y, long long v0, long long v1, long long, unsigned mask){
+                if (STATS_ENABLED){
+                    counts.pixels_covered++;
+                    overdraw_[y * width() + x]++;
+                }
+                const size_t first = sample_layout_.index(x, y) * n;
+                const real_t inverse_depth = f.inverseDepth(v0, v1);
+                sample_storage_t* depth = &sample_depth_[first];
+                unsigned passed = 0;
+                for (size_t s = 0; s < n; s++){
+                    const sample_storage_t encoded = SampleDepth::encode(inverse_depth + depth_offset[s]);
+                    const bool pass = ((mask >> s) & 1u) && depth[s] > encoded;
+                    depth[s] = pass ? encoded : depth[s];
+                    passed |= (unsigned)pass << s;
+                }
+                if (!passed){
+                    if (STATS_ENABLED)
+                        counts.depth_failed++;
+                    return;
+                }
+                if (STATS_ENABLED)
+                    counts.depth_passed++;
+
+                real_t z_interp = real_t(1) / inverse_depth;
+                if (mask != full){
+                    size_t s = 0;
+                    while (!(mask & (1u << s)))
+                        s++;
+                    v0 += samples.offset[0][s];
+                    v1 += samples.offset[1][s];
+                    z_interp = real_t(1) / (inverse_depth + depth_offset[s]);
+                }
+                const real_t q = f.perspective(v0, v1);
+                const size_t i = batch.push(f.x(v0, v1, q), f.y(v0, v1, q), z_interp, &sample_color_[first]);
+                masks[i] = passed;
+                for (size_t c = 0; c < ATTRIBUTE_CHANNELS; c++)
+                    if (interpolated(c))
+                        batch.attribute[c][i] = f.attribute(c, v0, v1, q);
+                if (batch.full())
+                    flushBatch(batch, store);
+            });
+            flushBatch(batch, store);
+            if (STATS_ENABLED)
+                profile_.add(counts);
         }
 
+        // Draw a triangle restricted to the rectangle [x0, x1] x [y0, y1] with the immediate shading
+        inline void drawTriangle(const RasterTriangle& t, long long x0, long long y0, long long x1, long long y1){
+            switch (pattern_.count){
+                case 2: rasterizeMultisample<2>(t, x0, y0, x1, y1); break;
+                case 4: rasterizeMultisample<4>(t, x0, y0, x1, y1); break;
+                case 8: rasterizeMultisample<8>(t, x0, y0, x1, y1); break;
+                default: rasterize<false>(t, 0, x0, y0, x1, y1);
+            }
+        }
+
+        // Multithreaded rasterization: triangles are binned into screen tiles, then each tile is drawn by a single worker
+        // going through its triangles in submission order. Tiles don't share pixels, so no locks are needed on the buffers
+        // and every pixel sees the same sequence of depth tests as in the single threaded path.
+        void renderTiled(){
+            const long long tiles_x = (width() + RASTER_TILE - 1) / RASTER_TILE;
+            const long long tiles_y = (height() + RASTER_TILE - 1) / RASTER_TILE;
+            {
+                StageTimer timer(profile_.setup);
+                binTriangles(tiles_x, tiles_y);
+            }
+
+            StageTimer timer(profile_.raster);
+            parallelFor(threads_, bins_.size(), [&](size_t tile, size_t){
+                long long x0 = (tile % tiles_x) * RASTER_TILE, y0 = (tile / tiles_x) * RASTER_TILE;
+                long long x1 = std::min(x0 + RASTER_TILE, width()) - 1, y1 = std::min(y0 + RASTER_TILE, height()) - 1;
+                for (size_t i : bins_[tile]){
+                    if (deferred_)
+                        rasterize<true>(raster_triangles_[i], (uint32_t)i, x0, y0, x1, y1);
+                    else
+                        drawTriangle(raster_triangles_[i], x0, y0, x1, y1);
+                }
+            });
+        }
+
+        // Second pass of the deferred shading: each pixel drawn in this frame is shaded once, with the weights of the
+        // triangle recorded in the visibility buffer evaluated again from its edge equations.
+        // A row of blocks is a unit of work, blocks not touched in this frame are skipped without reading their pixels
+        void shadeVisibility(){
+            if (raster_triangles_.empty())
+                return;
+            const size_t blocks_y = z_generation_.size() / blocks_x_;
+            parallelFor(threads_, blocks_y, [&](size_t by, size_t){
+                FragmentBatch<target_t> batch;
+                FragmentInterpolator<real_t> f = interpolator(raster_triangles_.front());
+                uint32_t current = 0;
+                for (long long bx = 0; bx < blocks_x_; bx++){
+                    if (z_generation_[by * blocks_x_ + bx] != frame_)
+                        continue;
+                    long long x0 = bx * RASTER_BLOCK, y0 = by * RASTER_BLOCK;
+                    long long x1 = std::min(x0 + RASTER_BLOCK, width()), y1 = std::min(y0 + RASTER_BLOCK, height());
+                    for (long long y = y0; y < y1; y++)
+                        for (long long x = x0; x < x1; x++){
+                            // A depth still at the clear value means no fragment reached the pixel
+                            if (z_buffer_(x, y) == depth_t::cleared())
+                                continue;
+                            // Neighbouring pixels mostly belong to the same triangle, whose planes are then reused
+                            const uint32_t id = visibility_(x, y);
+                            if (id != current){
+                                f = interpolator(raster_triangles_[id]);
+                                current = id;
+                            }
+                            const TriangleSetup& setup = raster_triangles_[id].setup;
+                            const long long w0 = setup.edge[0](x, y), w1 = setup.edge[1](x, y);
+                            const real_t z_interp = f.depth(w0, w1), q = f.perspective(w0, w1);
+                            const size_t i = batch.push(f.x(w0, w1, q), f.y(w0, w1, q), z_interp, &video_.pixel(x, y));
+                            for (size_t c = 0; c < ATTRIBUTE_CHANNELS; c++)
+                                if (interpolated(c))
+                                    batch.attribute[c][i] = f.attribute(c, w0, w1, q);
+                            if (batch.full())
+                                flushBatch(batch);
+                        }
+                }
+                flushBatch(batch);
+            });
+        }
+
+        // Last pass of the multisampling: the samples of every pixel drawn in this frame are resolved into video_.
+        // The other pixels are blank, as video_ was cleared where the previous frames drew
+        void resolveSamples(){
+            const size_t blocks_y = z_generation_.size() / blocks_x_, n = pattern_.count;
+            parallelFor(threads_, blocks_y, [&](size_t by, size_t){
+                for (long long bx = 0; bx < blocks_x_; bx++){
+                    if (z_generation_[by * blocks_x_ + bx] != frame_)
+                        continue;
+                    long long x0 = bx * RASTER_BLOCK, y0 = by * RASTER_BLOCK;
+                    long long x1 = std::min(x0 + RASTER_BLOCK, width()), y1 = std::min(y0 + RASTER_BLOCK, height());
+                    for (long long y = y0; y < y1; y++){
+                        for (long long x = x0; x < x1; x++){
+                            const size_t first = sample_layout_.index(x, y) * n;
+                            // A sample was written when it has a depth
+                            unsigned covered = 0;
+                            for (size_t s = 0; s < n; s++)
+                                covered |= (unsigned)(sample_depth_[first + s] != SampleDepth::cleared()) << s;
+                            video_.pixel(x, y) = SampleResolve<target_t>::resolve(&sample_color_[first], covered, n, (target_t)(' '));
+                        }
+                    }
+                }
+            });
+        }
+
+        // Set up every triangle in raster_triangles_ (same index as in assembled_)
+        void prepareTriangles(){
+            const size_t triangle_count = assembled_.size();
+            // Triangle setup is independent for each triangle, it's split in chunks among the workers
+            const size_t chunk = 1024;
+            raster_triangles_.resize(triangle_count);
+            parallelFor(threads_, (triangle_count + chunk - 1) / chunk, [&](size_t c, size_t){
+                for (size_t i = c * chunk; i < std::min(triangle_count, (c + 1) * chunk); i++)
+                    prepareTriangle(assembled_[i], raster_triangles_[i]);
+            });
+        }
+
+        // Set up every triangle in raster_triangles_ and list in bins_ the ones overlapping each tile
+        void binTriangles(long long tiles_x, long long tiles_y){
+            const size_t triangle_count = assembled_.size();
+            prepareTriangles();
+
+            // Binning keeps the submission order inside each tile
+            bins_.resize(tiles_x * tiles_y);
+            for (std::vector<size_t>& bin : bins_)
+                bin.clear();
+            for (size_t n = 0; n < triangle_count; n++){
+                size_t i = drawOrder(n);
+                const TriangleSetup& s = raster_triangles_[i].setup;
+                // Degenerate triangles are left with a zero area by their setup
+                if (s.area2 == 0)
+                    continue;
+                long long tx0 = std::max(s.x_min, 0LL) / RASTER_TILE, tx1 = std::min(s.x_max, width() - 1) / RASTER_TILE;
+                long long ty0 = std::max(s.y_min, 0LL) / RASTER_TILE, ty1 = std::min(s.y_max, height() - 1) / RASTER_TILE;
+                for (long long ty = ty0; ty <= ty1; ty++)
+                    for (long long tx = tx0; tx <= tx1; tx++)
+                        bins_[ty * tiles_x + tx].push_back(i);
+            }
+        }
 
     public:
 
         // Constructor allows to set a projection matrix and the desired fragment shader
-        // it also initializes the z-buffer to +infinite
-        Pipeline(ProjectionMatrix pm, IFragmentShader<target_t> *fs) : pm_(pm), fs_(fs){
-            this->clear_z_buffer_();
+        // the z-buffer starts as cleared to +infinite (all its blocks are older than the first frame)
+        Pipeline(ProjectionMatrix pm, shader_t *fs) : Pipeline(C, R, pm, fs){
+            static_assert(C != Dynamic && R != Dynamic, "A Dynamic pipeline needs the resolution in the constructor");
+        }
+
+        // Constructor with the resolution of the screen, needed when C and R are Dynamic
+        Pipeline(size_t width, size_t height, ProjectionMatrix pm, shader_t *fs) : video_(width, height), pm_(pm), fs_(fs), z_buffer_(width, height){
+            if (width == 0 || height == 0)
+                throw std::invalid_argument("The resolution of the pipeline must not be 0");
+            hiz_.resize(width, height);
+            hiz_.clear();
+            blocks_x_ = (width + RASTER_BLOCK - 1) / RASTER_BLOCK;
+            z_generation_.assign(blocks_x_ * ((height + RASTER_BLOCK - 1) / RASTER_BLOCK), 0u);
+            video_dirty_.assign(z_generation_.size(), 0);
+            if (STATS_ENABLED)
+                overdraw_.assign(width * height, 0);
         }
 
-        Pipeline(const Pipeline<target_t, C, R> & pp) = default;
-        Pipeline(Pipeline<target_t, C, R> && pp) = default;
+        Pipeline(const Pipeline & pp) = default;
+        Pipeline(Pipeline && pp) = default;
         
         // Destructor not used since no new (keyword) is called
         //~Pipeline() {delete vs_;delete fs_;}
 
+        // Setter method for the projection matrix, the vertices are transformed again at the next render
+        Pipeline& setProjectionMatrix(ProjectionMatrix pm){
+            pm_ = pm;
+            ndc_valid_ = false;
+            return *this;
+        }
+
+        // Setter method for the backface culling: triangles with the given winding on the screen are not drawn
+        Pipeline& setCullMode(CullMode mode){
+            if (mode != cull_)
+                assembly_valid_ = false;
+            cull_ = mode;
+            return *this;
+        }
+
         // Setter method for the shader
-        Pipeline<target_t, C, R>& setFragmentShader(IFragmentShader<target_t> *fs){
+        Pipeline& setFragmentShader(shader_t *fs){
             /*delete fs_;*/
             fs_ = fs;
             return *this;
         }
 
+        // Enable or disable drawing the triangles front to back (by their nearest vertex) instead of in submission order.
+        // More triangles are then rejected early by the hierarchical z-buffer; only fragments at exactly the same depth
+        // may resolve differently than with the submission order.
+        Pipeline& setDepthSort(bool enabled){
+            depth_sort_ = enabled;
+            return *this;
+        }
+
+        // Enable or disable the deferred shading: the triangles are drawn first, keeping only the depth and the triangle
+        // of each pixel, then the fragment shader is called once for each pixel that ends up covered. Hidden fragments
+        // are never shaded, which pays off with costly shaders and overlapping geometry; the picture is the same as
+        // with the immediate shading.
+        Pipeline& setDeferredShading(bool enabled){
+            if (enabled && pattern_.count > 1)
+                throw std::invalid_argument("Deferred shading is not available with multisampling");
+            deferred_ = enabled;
+            if (enabled && visibility_.getWidth() != video_.getWidth())
+                visibility_ = Framebuffer<uint32_t, TiledLayout<RASTER_BLOCK>>(video_.getWidth(), video_.getHeight());
+            return *this;
+        }
+
+        // Set the number of samples per pixel of the multisample anti-aliasing: 1 (the default) disables it, 2, 4 or 8
+        // enable it (see SamplePattern). The coverage of each sample comes from the edge equations and each sample has
+        // its own depth, stored in 32 bits (see SampleDepth), but the fragment shader is still called once per
+        // pixel and triangle. At the end of the frame the samples are resolved into the render (see SampleResolve).
+        // Not available together with the deferred shading.
+        Pipeline& setMultisample(size_t samples){
+            const SamplePattern pattern = SamplePattern::standard(samples);
+            if (samples > 1 && deferred_)
+                throw std::invalid_argument("Multisampling is not available with the deferred shading");
+            if (pattern.count == pattern_.count)
+                return *this;
+            // The sample buffers are cleared block by block by touchBlock, like the z-buffer
+            pattern_ = pattern;
+            sample_layout_ = TiledLayout<RASTER_BLOCK>(width(), height());
+            const size_t storage = samples > 1 ? sample_layout_.storage(width(), height()) * samples : 0;
+            sample_depth_ = AlignedBuffer<sample_storage_t>(storage);
+            sample_color_ = AlignedBuffer<target_t>(storage);
+            return *this;
+        }
+
+        // Set the number of threads used by render (0 uses all the hardware threads).
+        // With more than one thread the fragment shader is called concurrently, so it must not modify shared state.
+        Pipeline& setThreads(size_t threads){
+            threads_ = resolveThreadCount(threads);
+            return *this;
+        }
+
         // The render method contains the step execution needed to do the drawing of the object
-        Pipeline<target_t, C, R>& render(Scene scene){
-            video_.clear_container();
-            clear_z_buffer_();
-            double x_interp = 0, y_interp=0, z_interp;
+        // The scene is only read: its transformed vertices are kept by the pipeline and reused while the scene doesn't change
+        Pipeline& render(const Scene& scene){
+            return render(scene, ModelTransform());
+        }
 
-           // For each Vertex of the Scene, transform coordinates into ndc
-            computeNdc(scene.getSceneVertices());
+        // Render the scene placed in the camera space by a model transform, applied to the vertices while they are
+        // transformed: many instances of a mesh can be drawn from the same Scene without copying it
+        Pipeline& render(const Scene& scene, const ModelTransform& model){
+            if (PROFILE_ENABLED)
+                profile_.frames.add(1);
+            {
+                StageTimer timer(profile_.clear);
+                clear_buffers_();
+                if (STATS_ENABLED)
+                    std::fill(overdraw_.begin(), overdraw_.end(), 0u);
+            }
+
+           // For each Vertex of the Scene, transform coordinates into ndc (unless already done for this revision)
+            if (!ndc_valid_ || ndc_revision_ != scene.getRevision() || model_ != model){
+                StageTimer timer(profile_.ndc);
+                model_ = model;
+                computeNdc(scene.getSceneVertices());
+                gatherAttributes(scene);
+                ndc_revision_ = scene.getRevision();
+                ndc_valid_ = true;
+                assembly_valid_ = false;
+            }
+            // Culling and clipping, which depend only on the transformed vertices as well
+            if (!assembly_valid_){
+                StageTimer timer(profile_.assembly);
+                assemblePrimitives(scene);
+                assembly_valid_ = true;
+                order_valid_ = false;
+            }
+            if (depth_sort_ && !order_valid_){
+                StageTimer timer(profile_.assembly);
+                sortTriangles();
+                order_valid_ = true;
+            }
             
             // Rasterize
-            for (size_t triangle_idx=0; triangle_idx < scene.getSceneTriangles().size(); triangle_idx++){
-                
-                // Avoid redundancy by creating variables that will be used massively later
-                double x1 = x_to_screen(scene(triangle_idx, 0).getNdx());
-                double x2 = x_to_screen(scene(triangle_idx, 1).getNdx());
-                double x3 = x_to_screen(scene(triangle_idx, 2).getNdx());
-                double y1 = y_to_screen(scene(triangle_idx, 0).getNdy());
-                double y2 = y_to_screen(scene(triangle_idx, 1).getNdy());
-                double y3 = y_to_screen(scene(triangle_idx, 2).getNdy());
-                double z1 = scene(triangle_idx, 0).getNdz();
-                double z2 = scene(triangle_idx, 1).getNdz();
-                double z3 = scene(triangle_idx, 2).getNdz();
-
-                // setup inside-outside test by computing the rectangle coordinates and converting them into screen mode
-                size_t x_r_screen_min = std::min({x1, x2, x3});
-                size_t x_r_screen_max = std::max({x1, x2, x3});
-                size_t y_r_screen_min = std::min({y1, y2, y3});
-                size_t y_r_screen_max = std::max({y1, y2, y3});
-
-
-                // inside-outside test for each point in the rectangle
-                for (size_t x = x_r_screen_min; x <= x_r_screen_max; x++){
-                    for (size_t y = y_r_screen_min; y <= y_r_screen_max; y++){
-                        
-                        if (isInside(x, y, x1, x2, x3, y1, y2, y3)){
-
-                            // Compute the scalars of the convex combination for barycentric coordinates, of point (x, y) based on its triangle             
-                            scalars[0] = ((y2 - y3)*(x - x3) + (x3 - x2)*(y - y3)) / ((y2 - y3)*(x1 - x3) + (x3 - x2)*(y1 - y3));
-                            scalars[1] = ((y3 - y1)*(x - x3) + (x1 - x3)*(y - y3)) / ((y2 - y3)*(x1 - x3) + (x3 - x2)*(y1 - y3));
-                            scalars[2] = 1.0f - scalars[0] - scalars[1];
-
-                            //interpolate point
-                            x_interp = ( (scalars[0]/z1)*scene(triangle_idx, 0).getNdx() +  (scalars[1]/z2)*scene(triangle_idx, 1).getNdx() + (scalars[2]/z3)*scene(triangle_idx, 2).getNdx()) / (scalars[0]/z1 + scalars[1]/z2 + scalars[2]/z3);
-                            y_interp = ( (scalars[0]/z1)*scene(triangle_idx, 0).getNdy() +  (scalars[1]/z2)*scene(triangle_idx, 1).getNdy() + (scalars[2]/z3)*scene(triangle_idx, 2).getNdy()) / (scalars[0]/z1 + scalars[1]/z2 + scalars[2]/z3);;
-                            z_interp = ( (scalars[0]/z1)*z1 +  (scalars[1]/z2)*z2 + (scalars[2]/z3)*z3) / (scalars[0]/z1 + scalars[1]/z2 + scalars[2]/z3);;
-
-                            // update z_buff and pass the interpolated vertex of the fragment to fragmentshader (it returns a target_t)
-                            if (z_buffer_(x, y) > z_interp){
-                                z_buffer_(x, y) = z_interp;
-                                video_(x, y) = fs_->computeShader(x_interp, y_interp, z_interp, 0, 0, 0, 0, 0);  
-                            }    
-                        }
-                    } 
+            if (PROFILE_ENABLED)
+                profile_.triangles.add(assembled_.size());
+            if (STATS_ENABLED){
+                profile_.submitted.add(scene.getSceneTriangles().size());
+                profile_.add(assembly_counts_);
+            }
+            if (deferred_ && assembled_.size() > std::numeric_limits<uint32_t>::max())
+                throw std::length_error("Too many triangles for the visibility buffer of the deferred shading");
+            if (threads_ > 1)
+                renderTiled();
+            else if (deferred_){
+                // The second pass needs the setup of every triangle, so they are all prepared beforehand
+                {
+                    StageTimer timer(profile_.setup);
+                    prepareTriangles();
+                }
+                StageTimer timer(profile_.raster);
+                for (size_t n=0; n < assembled_.size(); n++){
+                    size_t i = drawOrder(n);
+                    if (raster_triangles_[i].setup.area2 != 0)
+                        rasterize<true>(raster_triangles_[i], (uint32_t)i, 0, 0, width() - 1, height() - 1);
                 }
             }
+            else {
+                // The setup of each triangle is done right before drawing it, so its time is part of the rasterization
+                StageTimer timer(profile_.raster);
+                RasterTriangle t;
+                for (size_t n=0; n < assembled_.size(); n++){
+                    if (prepareTriangle(assembled_[drawOrder(n)], t))
+                        drawTriangle(t, 0, 0, width() - 1, height() - 1);
+                }
+            }
+            if (deferred_){
+                StageTimer timer(profile_.raster);
+                shadeVisibility();
+            }
+            else if (pattern_.count > 1){
+                StageTimer timer(profile_.raster);
+                resolveSamples();
+            }
+            return *this;
+        }
+
+        // Time spent in each stage and work done by the renders since the last reset (see PipelineProfile),
+        // all zeros unless PIPELINE3D_PROFILE is defined
+        StageTimes getStageTimes() const {
+            return profile_.times();
+        }
+        Pipeline& resetStageTimes(){
+            profile_.reset();
+            return *this;
+        }
+
+        // Counters of the work done by the renders since the last reset (see PipelineStats), stage times included;
+        // all zeros unless PIPELINE3D_STATS is defined
+        PipelineStats getStats() const {
+            return profile_.stats(video_.getWidth() * video_.getHeight());
+        }
+        Pipeline& resetStats(){
+            profile_.reset();
+            return *this;
+        }
+
+        // Write in heatmap the number of triangles that covered each pixel in the last frame (before the depth test).
+        // Only available with PIPELINE3D_STATS
+        Pipeline& renderOverdraw(Render<int, C, R>& heatmap){
+            static_assert(STATS_ENABLED || sizeof(target_t) == 0, "renderOverdraw needs PIPELINE3D_STATS");
+            if (heatmap.getWidth() != video_.getWidth() || heatmap.getHeight() != video_.getHeight())
+                throw std::invalid_argument("Render resolution differs from the one of the pipeline");
+            for (size_t y = 0; y < heatmap.getHeight(); y++)
+                for (size_t x = 0; x < heatmap.getWidth(); x++)
+                    heatmap.pixel(x, y) = overdraw_[y * video_.getWidth() + x];
             return *this;
         }
 
         //Getter for Render, useful when the current rendered image has to be saved in an external Render object
+        // The caller may modify it, so the next render clears it entirely
         Render<target_t, C, R>& getRender(){
+            video_unknown_ = true;
+            return video_;
+        }
+        // Read only access, which keeps the lazy clears
+        const Render<target_t, C, R>& getRender() const {
             return video_;
         }
         
+        // Exchange the render of the pipeline with another one of the same resolution, e.g. to keep the last frame while
+        // drawing the next one in a second buffer. "blank" tells that the given render is entirely cleared, so the next
+        // render doesn't need to clear it. With a Dynamic resolution only the pixel pointers are exchanged.
+        Pipeline& swapRender(Render<target_t, C, R>& render, bool blank = false){
+            if (render.getWidth() != video_.getWidth() || render.getHeight() != video_.getHeight())
+                throw std::invalid_argument("Render resolution differs from the one of the pipeline");
+            std::swap(video_, render);
+            std::fill(video_dirty_.begin(), video_dirty_.end(), 0);
+            video_unknown_ = !blank;
+            return *this;
+        }
+
         // Wrapper methods for print and save render result
-        Pipeline<target_t, C, R>& print(){
+        Pipeline& print(){
             std::cout << video_;
             return *this;
         }
-        Pipeline<target_t, C, R>& fileSave(std::string filename){
+        Pipeline& fileSave(std::string filename){
             video_.fileSave(filename);
             return *this;
         }
 
+        // Print the render on a terminal rewriting only the rows changed since the previous frame sent to the stream
+        Pipeline& print(TerminalStream& stream){
+            stream << video_;
+            return *this;
+        }
+
+        // Wrappers of the binary writers of Render (see Render::savePGM, savePPM and saveRaw)
+        Pipeline& savePGM(const std::string& filename){
+            video_.savePGM(filename);
+            return *this;
+        }
+        Pipeline& savePPM(const std::string& filename){
+            video_.savePPM(filename);
+            return *this;
+        }
+        Pipeline& saveRaw(const std::string& filename){
+            video_.saveRaw(filename);
+            return *this;
+        }
+
 };
\ No newline at end of file
@@ -0,0 +1,66 @@
+/*
+Giacomo Arrigo 860022
+Marco Carfizzi 860149
+*/
+
+#include "raster.h"
+#include <cstdint>
+
+// Formats of the z-buffer: storage_t is the type of a stored depth, encode converts the interpolated depth (in [0, 1]
+// for the points between the near and the far plane) to it, and cleared() is the value of an empty pixel, farther than
+// any encoded depth. encode never decreases as the depth grows, so the bounds of the hierarchical z-buffer hold for
+// the encoded values as well. Fragments are stored if their encoded depth is smaller than the stored one.
+
+// 64 bit floating point depth, the original format
+struct DoubleDepth{
+    using storage_t = double;
+    static constexpr storage_t cleared(){return std::numeric_limits<double>::infinity();}
+    static inline storage_t encode(double z){return z;}
+};
+
+// 32 bit floating point depth, half the memory traffic of DoubleDepth
+struct FloatDepth{
+    using storage_t = float;
+    static constexpr storage_t cleared(){return std::numeric_limits<float>::infinity();}
+    static inline storage_t encode(double z){return (storage_t)z;}
+};
+
+// 24 bit integer depth (stored in 32 bit words): [0, 1] is mapped to [0, 2^24 - 1], depths outside are clamped
+// and NaN is never stored
+struct Depth24{
+    using storage_t = uint32_t;
+    static constexpr storage_t cleared(){return 1u << 24;}
+    static inline storage_t encode(double z){
+        if (std::isnan(z))
+            return cleared();
+        return z <= 0 ? 0 : z >= 1 ? cleared() - 1 : (storage_t)(z * (cleared() - 1) + 0.5);
+    }
+};
+
+// Precision policy of the pipeline:
+// - real_t is the type used for the interpolation of the fragments (barycentric weights, coordinates and depth)
+// - SubpixelBits is the number of fractional bits of the fixed point screen coordinates of the vertices used by the
+//   edge equations: 0 snaps the vertices to whole pixels, more bits avoid the cracks and the jitter of the snapping
+// - depth_t is the format of the z-buffer (DoubleDepth, FloatDepth or Depth24)
+// The edge equations are always evaluated exactly with integers.
+template <typename real_t_, int SubpixelBits, typename depth_t_>
+struct PrecisionPolicy{
+    // With more bits the edge equations of the triangles in the guard band may overflow 64 bit integers
+    static_assert(SubpixelBits >= 0 && SubpixelBits <= 8, "SubpixelBits must be between 0 and 8");
+    using real_t = real_t_;
+    using depth_t = depth_t_;
+    static constexpr int subpixel_bits = SubpixelBits;
+
+    // Fixed point screen coordinate of a point at (exact) screen coordinate v
+    static inline long long toFixed(double v){
+        return SubpixelBits == 0 ? (long long)floor(v) : std::llround(std::ldexp(v, SubpixelBits));
+    }
+};
+
+// Interpolation in double, vertices snapped to whole pixels and double depth: the original behaviour of the pipeline
+using DoublePrecision = PrecisionPolicy<double, 0, DoubleDepth>;
+// Interpolation and depth in float
+using FloatPrecision = PrecisionPolicy<float, 0, FloatDepth>;
+// Vertices on a grid of 2^Bits subpixels, interpolation in float and 24 bit integer depth
+template <int Bits = 4>
+using FixedPointPrecision = PrecisionPolicy<float, Bits, Depth24>;
@@ -0,0 +1,173 @@
+/*
+Giacomo Arrigo 860022
+Marco Carfizzi 860149
+*/
+
+#include "meshlet.h"
+#include <chrono>
+
+// Timing of the stages of the pipeline, collected only when PIPELINE3D_PROFILE is defined before including the library.
+// PIPELINE3D_STATS collects the timings as well as counters of the work done by each stage (see PipelineStats).
+// Without them the timers are empty objects and the counters are never updated, so the pipeline pays nothing for them.
+#if defined(PIPELINE3D_STATS) && !defined(PIPELINE3D_PROFILE)
+#define PIPELINE3D_PROFILE
+#endif
+#ifdef PIPELINE3D_PROFILE
+constexpr bool PROFILE_ENABLED = true;
+#else
+constexpr bool PROFILE_ENABLED = false;
+#endif
+#ifdef PIPELINE3D_STATS
+constexpr bool STATS_ENABLED = true;
+#else
+constexpr bool STATS_ENABLED = false;
+#endif
+
+// Counter that several threads can increment at once, copied along with the pipeline that owns it
+class ProfileCounter{
+    private:
+        std::atomic<unsigned long long> value_{0};
+
+    public:
+        ProfileCounter() = default;
+        ProfileCounter(const ProfileCounter& c) : value_(c.get()){}
+        ProfileCounter& operator = (const ProfileCounter& c){
+            value_ = c.get();
+            return *this;
+        }
+
+        inline void add(unsigned long long n){value_.fetch_add(n, std::memory_order_relaxed);}
+        inline unsigned long long get() const {return value_.load(std::memory_order_relaxed);}
+        inline void reset(){value_ = 0;}
+};
+
+// Adds the time elapsed between its construction and its destruction (in nanoseconds) to a counter
+#ifdef PIPELINE3D_PROFILE
+class StageTimer{
+    private:
+        ProfileCounter& counter_;
+        std::chrono::steady_clock::time_point start_;
+
+    public:
+        explicit StageTimer(ProfileCounter& counter) : counter_(counter), start_(std::chrono::steady_clock::now()){}
+        ~StageTimer(){
+            counter_.add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count());
+        }
+};
+#else
+class StageTimer{
+    public:
+        explicit StageTimer(ProfileCounter&){}
+};
+#endif
+
+// Times (milliseconds) and amount of work of the renders since the profile was last reset
+struct StageTimes{
+    unsigned long long frames = 0;
+    // Clearing the buffers, vertex transformation (computeNdc), culling and clipping, triangle setup and binning,
+    // and rasterization (which includes the shading)
+    double clear = 0, ndc = 0, assembly = 0, setup = 0, raster = 0;
+    // Time spent in the fragment shader, summed over the threads: with more than one thread it can exceed raster
+    double shading = 0;
+    // Triangles that reached the rasterizer and fragments that passed the depth test and were shaded
+    unsigned long long triangles = 0, fragments = 0;
+};
+
+// What the renders since the last reset did, collected with PIPELINE3D_STATS
+struct PipelineStats{
+    unsigned long long frames = 0;
+    // Triangles of the scenes, the ones discarded because entirely outside the frustum or by the backface culling,
+    // the ones that had to be clipped, and the ones that reached the rasterizer (a clipped triangle may become several)
+    unsigned long long triangles_submitted = 0, triangles_outside = 0, triangles_culled = 0, triangles_clipped = 0;
+    unsigned long long triangles_rasterized = 0;
+    // Meshlets rejected as a whole (their triangles are counted as outside or culled as well)
+    unsigned long long meshlets_rejected = 0;
+    // Triangles and RASTER_BLOCK blocks skipped by the hierarchical z-buffer
+    unsigned long long triangles_occluded = 0, blocks_occluded = 0;
+    // Pixels whose coverage was evaluated and pixels inside a triangle, which then go through the depth test
+    unsigned long long pixels_tested = 0, pixels_covered = 0;
+    unsigned long long depth_passed = 0, depth_failed = 0;
+    // Fragments given to the fragment shader
+    unsigned long long shader_invocations = 0;
+    // Average number of triangles covering a pixel in a frame
+    double overdraw = 0;
+    StageTimes times;
+};
+
+// Counts of the triangles discarded by the primitive assembly, computed when the assembly runs
+struct AssemblyCounts{
+    unsigned long long outside = 0, culled = 0, clipped = 0, meshlets_rejected = 0;
+};
+
+// Counts of a single call of the rasterizer, kept in local variables and added to the shared counters at the end
+struct RasterCounts{
+    unsigned long long triangles_occluded = 0, blocks_occluded = 0, pixels_tested = 0, pixels_covered = 0;
+    unsigned long long depth_passed = 0, depth_failed = 0;
+};
+
+// Counters of the stages, owned by a pipeline
+struct PipelineProfile{
+    ProfileCounter frames, clear, ndc, assembly, setup, raster, shading, triangles, fragments;
+    ProfileCounter submitted, outside, culled, clipped, meshlets_rejected, triangles_occluded, blocks_occluded;
+    ProfileCounter pixels_tested, pixels_covered, depth_passed, depth_failed;
+
+    void reset(){
+        for (ProfileCounter* c : {&frames, &clear, &ndc, &assembly, &setup, &raster, &shading, &triangles, &fragments,
+                                  &submitted, &outside, &culled, &clipped, &meshlets_rejected, &triangles_occluded, &blocks_occluded,
+                                  &pixels_tested, &pixels_covered, &depth_passed, &depth_failed})
+            c->reset();
+    }
+
+    void add(const AssemblyCounts& counts){
+        outside.add(counts.outside);
+        culled.add(counts.culled);
+        clipped.add(counts.clipped);
+        meshlets_rejected.add(counts.meshlets_rejected);
+    }
+
+    void add(const RasterCounts& counts){
+        triangles_occluded.add(counts.triangles_occluded);
+        blocks_occluded.add(counts.blocks_occluded);
+        pixels_tested.add(counts.pixels_tested);
+        pixels_covered.add(counts.pixels_covered);
+        depth_passed.add(counts.depth_passed);
+        depth_failed.add(counts.depth_failed);
+    }
+
+    // Statistics for a screen of "pixels" pixels
+    PipelineStats stats(unsigned long long pixels) const {
+        PipelineStats s;
+        s.frames = frames.get();
+        s.triangles_submitted = submitted.get();
+        s.triangles_outside = outside.get();
+        s.triangles_culled = culled.get();
+        s.triangles_clipped = clipped.get();
+        s.triangles_rasterized = triangles.get();
+        s.meshlets_rejected = meshlets_rejected.get();
+        s.triangles_occluded = triangles_occluded.get();
+        s.blocks_occluded = blocks_occluded.get();
+        s.pixels_tested = pixels_tested.get();
+        s.pixels_covered = pixels_covered.get();
+        s.depth_passed = depth_passed.get();
+        s.depth_failed = depth_failed.get();
+        s.shader_invocations = fragments.get();
+        if (s.frames && pixels)
+            s.overdraw = (double)s.pixels_covered / s.frames / pixels;
+        s.times = times();
+        return s;
+    }
+
+    StageTimes times() const {
+        StageTimes t;
+        t.frames = frames.get();
+        t.clear = clear.get() * 1e-6;
+        t.ndc = ndc.get() * 1e-6;
+        t.assembly = assembly.get() * 1e-6;
+        t.setup = setup.get() * 1e-6;
+        t.raster = raster.get() * 1e-6;
+        t.shading = shading.get() * 1e-6;
+        t.triangles = triangles.get();
+        t.fragments = fragments.get();
+        return t;
+    }
+};
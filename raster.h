@@ -0,0 +1,216 @@
+/*  
+Giacomo Arrigo 860022
+Marco Carfizzi 860149
+*/
+
+#include "shader.h"
+
+// Side (in pixels) of the square blocks walked by the rasterizer, blocks are aligned to the screen grid
+constexpr long long RASTER_BLOCK = 8;
+// Side (in pixels) of the screen tiles triangles are binned into when rendering with multiple threads,
+// a multiple of RASTER_BLOCK so that every block belongs to exactly one tile
+constexpr long long RASTER_TILE = 64;
+
+// Edge equation E(x, y) = a*x + b*y + c of the oriented edge (x0, y0) -> (x1, y1)
+// Moving one pixel to the right adds a to E and moving one pixel down adds b, so E can be stepped by addition
+struct EdgeFunction{
+    long long a, b, c;
+    // Smallest value of E for which a point is considered inside (top-left fill rule)
+    long long min_inside;
+
+    EdgeFunction() = default;
+    EdgeFunction(long long x0, long long y0, long long x1, long long y1) : a(y0 - y1), b(x1 - x0), c(x0*y1 - y0*x1){
+        // The screen y axis points down: a left edge goes up (a > 0), a top edge is horizontal and goes right (a == 0, b > 0)
+        // Points lying exactly on the edge are inside only for top and left edges, so shared edges are drawn once
+        min_inside = (a > 0 || (a == 0 && b > 0)) ? 0 : 1;
+    }
+
+    inline long long operator()(long long x, long long y) const {return a*x + b*y + c;}
+};
+
+// Floor and ceiling of a / b for b > 0, rounding towards -infinity and +infinity also for negative a
+inline long long floorDiv(long long a, long long b){return a / b - (a % b < 0 ? 1 : 0);}
+inline long long ceilDiv(long long a, long long b){return -floorDiv(-a, b);}
+
+// Data computed once per triangle before walking its pixels
+struct TriangleSetup{
+    // edge[i] is the edge opposite to vertex i, its value in (x, y) is the unnormalized barycentric weight of vertex i
+    EdgeFunction edge[3];
+    // Twice the area of the triangle, equal to the sum of the three weights in every point
+    long long area2;
+    // Bounding box of the triangle (inclusive)
+    long long x_min, x_max, y_min, y_max;
+
+    // Builds the edge equations from the screen coordinates of the vertices
+    // With subpixel_bits = 0 the coordinates are whole pixels and pixels are sampled at their integer coordinates.
+    // Otherwise they are fixed point numbers with subpixel_bits fractional bits and pixels are sampled at their centers:
+    // the equations are set up exactly on the subpixel grid, then rescaled so that they are still stepped one pixel
+    // at a time and area2 and the weights are in the same (subpixel) units.
+    // Returns false for degenerate triangles, which don't cover any pixel
+    bool init(const long long x[3], const long long y[3], int subpixel_bits = 0){
+        area2 = EdgeFunction(x[0], y[0], x[1], y[1])(x[2], y[2]);
+        if (area2 == 0)
+            return false;
+        // Orient the edges so that the inside of the triangle is always on their positive side
+        for (int i = 0; i < 3; i++){
+            int j = (i + 1) % 3, k = (i + 2) % 3;
+            edge[i] = area2 > 0 ? EdgeFunction(x[j], y[j], x[k], y[k]) : EdgeFunction(x[k], y[k], x[j], y[j]);
+        }
+        area2 = std::abs(area2);
+        x_min = std::min({x[0], x[1], x[2]});
+        x_max = std::max({x[0], x[1], x[2]});
+        y_min = std::min({y[0], y[1], y[2]});
+        y_max = std::max({y[0], y[1], y[2]});
+        if (subpixel_bits > 0){
+            const long long one = 1LL << subpixel_bits, half = one / 2;
+            // E(x * one + half, y * one + half) = (a * one) * x + (b * one) * y + c + (a + b) * half
+            for (EdgeFunction& e : edge){
+                e.c += (e.a + e.b) * half;
+                e.a *= one;
+                e.b *= one;
+            }
+            // Pixels whose center is inside the bounding box, the box is empty if there is none
+            x_min = ceilDiv(x_min - half, one);
+            x_max = floorDiv(x_max - half, one);
+            y_min = ceilDiv(y_min - half, one);
+            y_max = floorDiv(y_max - half, one);
+        }
+        return true;
+    }
+};
+
+// Screen-space triangle ready to be rasterized: edge equations plus the ndc values of its vertices used for interpolation
+struct RasterTriangle{
+    TriangleSetup setup;
+    double ndx[3], ndy[3], ndz[3];
+    // View space depth (Z) of the vertices, the w of the perspective division
+    double w[3];
+    // Conservative range of the depth of the fragments (see triangleDepthRange)
+    double z_min, z_max;
+    // Indices of the vertices in the buffers of the pipeline, used to find their attributes
+    size_t vertex[3];
+};
+
+// Interpolation over a RasterTriangle, computed in real_t.
+// Screen space weights s_k (the barycentric coordinates of the pixel on the screen) are not linear in the scene, so a
+// quantity with values a_k at the vertices is interpolated perspective correctly as sum(s_k a_k / w_k) / sum(s_k / w_k),
+// with w_k the view space depth (Z) of the vertices. The depth of the z-buffer keeps its own formula, 1 / sum(s_k / z_k)
+// with z_k the ndc depths. All the sums are linear in the edge functions w0 and w1 (w2 is area2 - w0 - w1), so their
+// planes are set up once per triangle: a fragment costs two reciprocals, its depth and the perspective factor
+// 1 / sum(s_k / w_k), and two products per quantity, evaluated from the exact integer weights stepped by the rasterizer.
+// The rasterizer and the deferred shading pass both go through it, so a fragment gets the same values in both.
+template <typename real_t>
+struct FragmentInterpolator{
+    // P(w0, w1) = c + w0 * d0 + w1 * d1
+    struct Plane{
+        real_t c, d0, d1;
+        inline real_t operator()(long long w0, long long w1) const {return c + w0 * d0 + w1 * d1;}
+    };
+
+    real_t inv_w[3], inv_area2;
+    Plane depth_plane, perspective_plane, x_plane, y_plane;
+    Plane attribute_plane[ATTRIBUTE_CHANNELS];
+
+    // weight_scale tells that the weights given to the methods are multiplied by it (see SampleEdges)
+    explicit FragmentInterpolator(const RasterTriangle& t, long long weight_scale = 1){
+        inv_area2 = real_t(1) / ((real_t)t.setup.area2 * (real_t)weight_scale);
+        const double ones[3] = {1, 1, 1};
+        const real_t inv_z[3] = {real_t(1) / (real_t)t.ndz[0], real_t(1) / (real_t)t.ndz[1], real_t(1) / (real_t)t.ndz[2]};
+        depth_plane = plane(ones, inv_z);
+        for (int k = 0; k < 3; k++)
+            inv_w[k] = real_t(1) / (real_t)t.w[k];
+        perspective_plane = plane(ones);
+        x_plane = plane(t.ndx);
+        y_plane = plane(t.ndy);
+    }
+
+    // Plane of sum(s_k a_k * inv[k])
+    Plane plane(const double a[3], const real_t inv[3]) const {
+        const real_t v[3] = {(real_t)a[0] * inv[0], (real_t)a[1] * inv[1], (real_t)a[2] * inv[2]};
+        return {v[2], (v[0] - v[2]) * inv_area2, (v[1] - v[2]) * inv_area2};
+    }
+    // Plane of sum(s_k a_k / w_k)
+    Plane plane(const double a[3]) const {
+        return plane(a, inv_w);
+    }
+    void setAttribute(size_t channel, const double a[3]){
+        attribute_plane[channel] = plane(a);
+    }
+
+    inline real_t depth(long long w0, long long w1) const {return real_t(1) / depth_plane(w0, w1);}
+    // Reciprocal of the depth, before the division
+    inline real_t inverseDepth(long long w0, long long w1) const {return depth_plane(w0, w1);}
+    // Perspective factor 1 / sum(s_k / w_k), taken by the other quantities
+    inline real_t perspective(long long w0, long long w1) const {return real_t(1) / perspective_plane(w0, w1);}
+    inline real_t x(long long w0, long long w1, real_t q) const {return x_plane(w0, w1) * q;}
+    inline real_t y(long long w0, long long w1, real_t q) const {return y_plane(w0, w1) * q;}
+    inline real_t attribute(size_t channel, long long w0, long long w1, real_t q) const {return attribute_plane[channel](w0, w1) * q;}
+};
+
+// Walks the pixels of a triangle inside the rectangle [x0, x1] x [y0, y1] (inclusive) and calls
+// fragment(x, y, w0, w1, w2) for each covered pixel, where wi is the unnormalized barycentric weight of vertex i.
+// The bounding box is split into RASTER_BLOCK-sized blocks: blocks fully outside an edge are skipped,
+// blocks fully inside the triangle don't need the per-pixel test.
+// Before walking a block, block(bx, by, covered) is called with the block grid coordinates and whether the triangle
+// covers all the pixels the block has inside the rectangle; the block is skipped if it returns false.
+template <typename block_f, typename fragment_f>
+void rasterizeTriangle(const TriangleSetup& t, long long x0, long long y0, long long x1, long long y1, block_f&& block, fragment_f&& fragment){
+    const long long clip_x0 = x0, clip_y0 = y0, clip_x1 = x1, clip_y1 = y1;
+    x0 = std::max(x0, t.x_min);
+    x1 = std::min(x1, t.x_max);
+    y0 = std::max(y0, t.y_min);
+    y1 = std::min(y1, t.y_max);
+    if (x0 > x1 || y0 > y1)
+        return;
+
+    for (long long by = y0 - y0 % RASTER_BLOCK; by <= y1; by += RASTER_BLOCK){
+        long long py0 = std::max(by, y0), py1 = std::min(by + RASTER_BLOCK - 1, y1);
+
+        for (long long bx = x0 - x0 % RASTER_BLOCK; bx <= x1; bx += RASTER_BLOCK){
+            long long px0 = std::max(bx, x0), px1 = std::min(bx + RASTER_BLOCK - 1, x1);
+
+            // E is linear, so its extremes over the block are found in the corners
+            bool outside = false, inside = true;
+            for (const EdgeFunction& e : t.edge){
+                long long corner = e(px0, py0);
+                long long dx = e.a * (px1 - px0), dy = e.b * (py1 - py0);
+                long long e_min = corner + std::min(dx, 0LL) + std::min(dy, 0LL);
+                long long e_max = corner + std::max(dx, 0LL) + std::max(dy, 0LL);
+                if (e_max < e.min_inside){
+                    outside = true;
+                    break;
+                }
+                inside = inside && e_min >= e.min_inside;
+            }
+            if (outside)
+                continue;
+
+            // The walked part of the block may be smaller than the block because of the bounding box of the triangle
+            bool covered = inside && px0 == std::max(bx, clip_x0) && px1 == std::min(bx + RASTER_BLOCK - 1, clip_x1) &&
+                           py0 == std::max(by, clip_y0) && py1 == std::min(by + RASTER_BLOCK - 1, clip_y1);
+            if (!block(bx / RASTER_BLOCK, by / RASTER_BLOCK, covered))
+                continue;
+
+            long long w0_row = t.edge[0](px0, py0), w1_row = t.edge[1](px0, py0), w2_row = t.edge[2](px0, py0);
+            for (long long y = py0; y <= py1; y++){
+                long long w0 = w0_row, w1 = w1_row, w2 = w2_row;
+                for (long long x = px0; x <= px1; x++){
+                    if (inside || (w0 >= t.edge[0].min_inside && w1 >= t.edge[1].min_inside && w2 >= t.edge[2].min_inside))
+                        fragment(x, y, w0, w1, w2);
+                    w0 += t.edge[0].a;
+                    w1 += t.edge[1].a;
+                    w2 += t.edge[2].a;
+                }
+                w0_row += t.edge[0].b;
+                w1_row += t.edge[1].b;
+                w2_row += t.edge[2].b;
+            }
+        }
+    }
+}
+
+// Same as above, walking every block
+template <typename fragment_f>
+void rasterizeTriangle(const TriangleSetup& t, long long x0, long long y0, long long x1, long long y1, fragment_f&& fragment){
+    rasterizeTriangle(t, x0, y0, x1, y1, [](long long, long long, bool){return true;}, fragment);
+}
\ No newline at end of file
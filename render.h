@@ -3,42 +3,140 @@ Giacomo Arrigo 860022
 Marco Carfizzi 860149
 */
 
-#include "scene.h"
+#include "framebuffer.h"
+#include <string>
+#include <sstream>
 
 
+// Value of C and R selecting a resolution chosen at runtime
+constexpr size_t Dynamic = 0;
+
+// Storage of the pixels of a Render: with a resolution known at compile time the class holds a std::array
+// to hold the screen matrix in a contiguous memory section
+template<typename target_t, size_t C, size_t R>
+class RenderStorage{
+    protected:
+        std::array<target_t, R*C> container_;
+
+    public:
+        RenderStorage() = default;
+        RenderStorage(size_t width, size_t height){
+            if (width != C || height != R)
+                throw std::invalid_argument("Resolution differs from the one of the template arguments");
+        }
+        size_t getWidth() const {return C;}
+        size_t getHeight() const {return R;}
+        std::array<target_t, C * R>& getTarget()    {return container_;}
+};
+
+// With C = R = Dynamic the resolution is given to the constructor and the pixels live in a heap allocated,
+// cache line aligned Framebuffer, so large screens don't need to fit on the stack
+template<typename target_t>
+class RenderStorage<target_t, Dynamic, Dynamic>{
+    protected:
+        Framebuffer<target_t> container_;
+
+    public:
+        RenderStorage() = default;
+        RenderStorage(size_t width, size_t height) : container_(width, height){}
+        size_t getWidth() const {return container_.getWidth();}
+        size_t getHeight() const {return container_.getHeight();}
+        Framebuffer<target_t>& getTarget()    {return container_;}
+};
+
+// Text of a pixel as printed on the screen, appended to out: the value 32 (space) is left blank for every type,
+// char pixels are printed as characters and the other integers as numbers, bool, signed char and unsigned char
+// (int8_t, uint8_t) included, so small values don't come out as control characters
+template <typename T>
+inline typename std::enable_if<std::is_same<T, char>::value>::type appendPixelText(std::string& out, T value){
+    out.push_back(value);
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, char>::value>::type appendPixelText(std::string& out, T pixel){
+    // Types smaller than int (bool among them) are promoted, so they compare and format like the other integers
+    const auto value = +pixel;
+    if (value == 32){
+        out.push_back(' ');
+        return;
+    }
+    // Digits are produced backwards in a small buffer, avoiding a stream or a string per pixel
+    char digits[24];
+    char* end = digits + sizeof(digits);
+    char* p = end;
+    bool negative = value < 0;
+    unsigned long long magnitude = negative ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    do {
+        *--p = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (negative)
+        *--p = '-';
+    out.append(p, end);
+}
+
+template <typename T>
+inline typename std::enable_if<!std::is_integral<T>::value>::type appendPixelText(std::string& out, const T& value){
+    if (value == 32){
+        out.push_back(' ');
+        return;
+    }
+    // Generic types go through a stream, reused by the pixels formatted by the same thread
+    thread_local std::ostringstream stream;
+    stream.str("");
+    stream.clear();
+    stream << value;
+    out += stream.str();
+}
+
+// Conversions of a pixel to a grey level or to an RGB color used by the image writers: values are clamped to [0, 255]
+// (NaN gives 0)
+template <typename T>
+inline unsigned char pixelToGrey(const T& value){
+    return !(value > 0) ? 0 : value >= 255 ? 255 : (unsigned char)value;
+}
+
+template <typename T>
+inline std::array<unsigned char, 3> pixelToRgb(const T& value){
+    unsigned char grey = pixelToGrey(value);
+    return {{grey, grey, grey}};
+}
+
 /* implementation of the software target 
  * if the Render class represent a screen, the target_t is the type of the smallest part ("pixel")
- * C is the width and R is the height of the screen
+ * C is the width and R is the height of the screen (Dynamic for a resolution chosen at runtime)
  */
 
 template<typename target_t, size_t C, size_t R>
-class Render{
+class Render : public RenderStorage<target_t, C, R>{
     private:
-        // The class holds a std::array to hold the screen matrix in a contiguous memory section
-        std::array<target_t, R*C> container_;
+        using RenderStorage<target_t, C, R>::container_;
 
     public:
+        using RenderStorage<target_t, C, R>::getWidth;
+        using RenderStorage<target_t, C, R>::getHeight;
+        using RenderStorage<target_t, C, R>::getTarget;
+
     // Makes the container "blank"
         inline void clear_container(){
-            for (size_t i = 0; i < container_.size(); i++){
-                    // std::vector container is filled with something representing void
-                    container_[i] = (target_t)(' ');
-            }
+            // container is filled with something representing void, a single fill over contiguous memory the compiler vectorizes
+            std::fill(container_.data(), container_.data() + container_.size(), (target_t)(' '));
         }
         // Default constructor
         Render(){
             this->clear_container();
         }
 
-        // Copy constructor
-        Render(const Render<target_t, C, R> &t){
-            container_ = t.container_;
+        // Constructor with the resolution, needed when C and R are Dynamic
+        Render(size_t width, size_t height) : RenderStorage<target_t, C, R>(width, height){
+            this->clear_container();
         }
 
+        // Copy constructor
+        Render(const Render<target_t, C, R> &t) : RenderStorage<target_t, C, R>(t){}
+
         // Move constructor
-        Render(Render<target_t, C, R> &&t){
-            container_ = std::move(t.container_);
-        }
+        Render(Render<target_t, C, R> &&t) : RenderStorage<target_t, C, R>(std::move(t)){}
 
         //Copy assignment
         void operator = (const Render<target_t, C, R> &t){
@@ -50,82 +148,174 @@ class Render{
             container_ = std::move(t.container_);
         }
 
-        // Getter methods
-        size_t getWidth()   {return C;}
-        size_t getHeight()  {return R;}
-        std::array<target_t, C * R>& getTarget()    {return container_;}
-
         // Overloading of () operator, this allows for direct access to location (x, y) of the target
         // hiding the fact that the matrix is in fact represented in one dimension
         target_t& operator()(const size_t y, const size_t x){
-            if (x >= R || y >= C)
+            if (x >= getHeight() || y >= getWidth())
                 throw std::out_of_range("Target indices out of range");
-            return container_[C*x + y];
+            return container_.data()[getWidth()*x + y];
+        }
+
+        // Same as operator() without the bounds check, used by the pipeline for pixels it already knows are on screen
+        inline target_t& pixel(const size_t x, const size_t y){
+            return container_.data()[getWidth()*y + x];
+        }
+
+        // First pixel of row y, the getWidth() pixels of a row are contiguous
+        inline const target_t* row(const size_t y) const {
+            return container_.data() + getWidth()*y;
+        }
+
+        // Append to out the text of row y, framed by the side borders, without the line break
+        void appendRowText(std::string& out, size_t y) const {
+            const target_t* pixels = row(y);
+            out.push_back('|');
+            for (size_t x = 0; x < getWidth(); x++)
+                appendPixelText(out, pixels[x]);
+            out.push_back('|');
+        }
+
+        // Append to out the whole framed picture, as printed by operator<<
+        void appendText(std::string& out) const {
+            std::string border = "+" + std::string(getWidth(), '-') + "+\n";
+            out.reserve(out.size() + (getWidth() + 3) * (getHeight() + 2));
+            out += border;
+            for (size_t y = 0; y < getHeight(); y++){
+                appendRowText(out, y);
+                out.push_back('\n');
+            }
+            out += border;
+        }
+
+        // Save the render as a binary greyscale PGM (P5) image, "to_grey" maps a pixel to its grey level (0 black, 255 white)
+        template <typename grey_f>
+        void savePGM(const std::string& filename, grey_f&& to_grey) const {
+            std::string header = "P5\n" + std::to_string(getWidth()) + " " + std::to_string(getHeight()) + "\n255\n";
+            std::string data(header.size() + getWidth() * getHeight(), '\0');
+            std::copy(header.begin(), header.end(), data.begin());
+            unsigned char* out = reinterpret_cast<unsigned char*>(&data[header.size()]);
+            for (size_t i = 0; i < getWidth() * getHeight(); i++)
+                out[i] = to_grey(container_.data()[i]);
+            writeFile(filename, data.data(), data.size());
+        }
+        void savePGM(const std::string& filename) const {
+            savePGM(filename, pixelToGrey<target_t>);
+        }
+
+        // Save the render as a binary color PPM (P6) image, "to_rgb" maps a pixel to a std::array of its red, green and blue
+        template <typename rgb_f>
+        void savePPM(const std::string& filename, rgb_f&& to_rgb) const {
+            std::string header = "P6\n" + std::to_string(getWidth()) + " " + std::to_string(getHeight()) + "\n255\n";
+            std::string data(header.size() + 3 * getWidth() * getHeight(), '\0');
+            std::copy(header.begin(), header.end(), data.begin());
+            unsigned char* out = reinterpret_cast<unsigned char*>(&data[header.size()]);
+            for (size_t i = 0; i < getWidth() * getHeight(); i++){
+                std::array<unsigned char, 3> rgb = to_rgb(container_.data()[i]);
+                out[3*i] = rgb[0];
+                out[3*i + 1] = rgb[1];
+                out[3*i + 2] = rgb[2];
+            }
+            writeFile(filename, data.data(), data.size());
+        }
+        void savePPM(const std::string& filename) const {
+            savePPM(filename, pixelToRgb<target_t>);
+        }
+
+        // Save the pixels as they are in memory (row by row, getWidth() * getHeight() values of sizeof(target_t) bytes),
+        // with no header: the fastest way to dump frames that are read back by another program
+        void saveRaw(const std::string& filename) const {
+            static_assert(std::is_trivially_copyable<target_t>::value, "saveRaw needs a trivially copyable target_t");
+            writeFile(filename, container_.data(), getWidth() * getHeight() * sizeof(target_t));
         }
 
         // Setting up the overload of the << operator for the print 
         template <typename T, size_t Co, size_t Ro> 
-        friend std::ostream& operator << (std::ostream& stream, Render<T, Co, Ro>& video);
+        friend std::ostream& operator << (std::ostream& stream, const Render<T, Co, Ro>& video);
 
         // Save the container into a file (file name is chosen by the user)
-        void fileSave(std::string filename){
-            std::ofstream outFile("./" + filename + ".dat");
-            int col = 1;
-            size_t cont = 0;
-            outFile << "+";
-            for (size_t i = 0; i < C; i++)
-                outFile << "-";
-            outFile << "+\n|";
-            for (const auto &i : container_){
-                // Check for space in int case
-                if (i == 32)
-                    outFile << ' ';
-                else
-                    outFile << i;
-                // Check if a row has ended and eventually break the line
-                if (cont == col * (C) -1){
-                    col++;
-                    outFile << "|\n";
-                    if (col <= R)
-                        outFile << "|";
-                }
-                cont++;
-            }
-            outFile << "+";
-            for (size_t i = 0; i < C; i++)
-                outFile << "-";
-            outFile << "+\n";
+        // The text is built in memory and written at once, a failure throws like the other savers
+        void fileSave(std::string filename) const {
+            std::string text;
+            appendText(text);
+            writeFile("./" + filename + ".dat", text.data(), text.size());
             std::cout << "File " << filename << ".dat correctly saved in current directory.\n";
         }
+
+    private:
+        // Write size bytes to a file with a single call
+        static void writeFile(const std::string& filename, const void* data, size_t size){
+            std::ofstream outFile(filename, std::ios::binary);
+            if (!outFile)
+                throw std::runtime_error("Cannot open " + filename);
+            outFile.write(static_cast<const char*>(data), size);
+            if (!outFile)
+                throw std::runtime_error("Cannot write " + filename);
+        }
 };
 
 // Overload of the << operator for a simpler print
+// The picture is formatted in memory first, so the stream gets a single write
 template <typename target_t, size_t C, size_t R>
-std::ostream& operator << (std::ostream& stream, Render<target_t, C, R>& video){
-    int col = 1;
-    size_t cont = 0;
-    stream << "+";
-    for (size_t i = 0; i < C; i++)
-        stream << "-";
-    stream << "+\n|";
-    for (const auto& i: video.getTarget()){
-        // Check for space in int case
-        if (i == 32)
-            stream << ' ';
-        else
-            stream << i;
-        // Check if a row has ended and eventually break the line
-        if (cont == col * (video.getWidth()) -1){
-            col++;
-            stream << "|\n";
-            if (col <= R)
-                stream << "|";
-        }
-        cont++;
-    }
-    stream << "+";
-    for (size_t i = 0; i < C; i++)
-        stream << "-";
-    stream << "+\n";
+std::ostream& operator << (std::ostream& stream, const Render<target_t, C, R>& video){
+    std::string text;
+    video.appendText(text);
+    stream.write(text.data(), text.size());
     return stream;
+};
+
+// Prints a sequence of renders on an ANSI terminal, redrawing only what changed: the first frame (or one with a different
+// resolution) is printed whole after clearing the screen, the following ones only rewrite the rows whose text differs
+// from the previous frame, moving the cursor there with escape sequences. Each frame is sent with a single write.
+class TerminalStream{
+    private:
+        std::ostream& stream_;
+        std::vector<std::string> rows_;
+        size_t width_ = 0;
+        std::string text_, row_;
+
+        static void moveCursor(std::string& out, size_t row, size_t column){
+            out += "\x1b[" + std::to_string(row) + ";" + std::to_string(column) + "H";
+        }
+
+    public:
+        explicit TerminalStream(std::ostream& stream = std::cout) : stream_(stream){}
+
+        // Forget the previous frame, the next one is printed whole
+        void reset(){
+            rows_.clear();
+            width_ = 0;
+        }
+
+        template <typename target_t, size_t C, size_t R>
+        TerminalStream& operator << (const Render<target_t, C, R>& video){
+            text_.clear();
+            const size_t height = video.getHeight();
+            const bool redraw = rows_.size() != height || width_ != video.getWidth();
+            if (redraw){
+                rows_.assign(height, std::string());
+                width_ = video.getWidth();
+                text_ += "\x1b[2J\x1b[H";
+                video.appendText(text_);
+            }
+            for (size_t y = 0; y < height; y++){
+                row_.clear();
+                video.appendRowText(row_, y);
+                if (!redraw && row_ == rows_[y])
+                    continue;
+                // Row y is on line y + 2 of the terminal, below the top border; the rest of the line is erased
+                // since rows of numbers may get shorter
+                if (!redraw){
+                    moveCursor(text_, y + 2, 1);
+                    text_ += row_;
+                    text_ += "\x1b[K";
+                }
+                rows_[y].swap(row_);
+            }
+            // The cursor is left below the picture
+            if (!redraw)
+                moveCursor(text_, height + 3, 1);
+            stream_.write(text_.data(), text_.size());
+            stream_.flush();
+            return *this;
+        }
 };
\ No newline at end of file
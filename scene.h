@@ -8,12 +8,41 @@ Marco Carfizzi 860149
 // Arrays (size_t elements) with size 3 are called Triangle, but are in fact "coordinates" and NOT sets of Vertex objects, as shown later
 using Triangle = std::array<size_t, 3>;
 
+// Cluster of consecutive triangles of a scene (see optimizeMesh in meshlet.h) with bounds used to reject it as a whole:
+// a sphere containing its vertices and a cone containing the normals of its triangles
+struct Meshlet{
+    size_t first_triangle, triangle_count;
+    double center[3], radius;
+    // Unit axis of the normal cone and cosine of its half angle; the cone is not usable when cone_cutoff <= 0
+    // (normals spread over more than a half space). Normals follow the winding, n = (v1 - v0) x (v2 - v0)
+    double cone_axis[3], cone_cutoff;
+};
 
 // Representation of a scene, with the unique vertices and the coordinates of the triangles' edges with respect to the vertices' array
+// The getters only read the scene. It's modified through the references given by editVertices and editTriangles, which
+// mark it as changed: a pipeline then transforms its vertices again at the next render. A reference is good for the
+// changes made before the next render of the scene; changes made after it must go through a new call, or the
+// pipelines keep drawing the vertices they cached.
 class Scene {
     private:
         std::vector<Vertex>  vertices_;
         std::vector<Triangle> triangles_;
+        // Attributes of the vertices stored as structure of arrays, one array per channel (see ATTRIBUTE_CHANNELS):
+        // only the channels of the attributes in attribute_layout_ are filled, the other arrays are empty
+        unsigned attribute_layout_ = ATTRIBUTES_NONE;
+        std::array<std::vector<double>, ATTRIBUTE_CHANNELS> channels_;
+        // Optional partition of triangles_ into meshlets, dropped only by editVertices and editTriangles
+        std::vector<Meshlet> meshlets_;
+        // Identifies the content of the scene: pipelines compare it to know if their transformed vertices are still valid
+        // Copies share the revision of the original, every call to editVertices or editTriangles gets a new one
+        unsigned long long revision_ = nextRevision();
+
+        // Revisions come from a global counter, so two different scenes never have the same one
+        static unsigned long long nextRevision(){
+            static std::atomic<unsigned long long> counter(0);
+            return ++counter;
+        }
+
     public:
         Scene() = default;
         // Copy constructor 
@@ -21,19 +50,108 @@ class Scene {
         // Move constructor
         Scene(std::vector<Vertex>&& vertices, std::vector<Triangle>&& coordinates) : vertices_(std::move(vertices)), triangles_(std::move(coordinates)){}
 
+        // Constructor from vertices with attributes, which are split in one array per channel
+        template <unsigned Layout>
+        Scene(const std::vector<AttributeVertex<Layout>>& vertices, const std::vector<Triangle>& coordinates) : triangles_(coordinates), attribute_layout_(Layout){
+            vertices_.reserve(vertices.size());
+            for (size_t c = 0, k = 0; c < ATTRIBUTE_CHANNELS; c++){
+                if (!(Layout & channelAttribute(c)))
+                    continue;
+                channels_[c].resize(vertices.size());
+                for (size_t i = 0; i < vertices.size(); i++)
+                    channels_[c][i] = vertices[i].getAttributes()[k];
+                k++;
+            }
+            for (const AttributeVertex<Layout>& v : vertices)
+                vertices_.emplace_back(v.getX(), v.getY(), v.getZ());
+        }
+
+        // Constructor with the attribute channels already split, each holding one value per vertex for the attributes in layout
+        Scene(std::vector<Vertex>&& vertices, std::vector<Triangle>&& coordinates, unsigned layout,
+              std::array<std::vector<double>, ATTRIBUTE_CHANNELS>&& channels) :
+              vertices_(std::move(vertices)), triangles_(std::move(coordinates)), attribute_layout_(layout), channels_(std::move(channels)){
+            for (size_t c = 0; c < ATTRIBUTE_CHANNELS; c++)
+                if ((layout & channelAttribute(c)) && channels_[c].size() != vertices_.size())
+                    throw std::invalid_argument("Attribute values differ in number from the vertices");
+        }
+
+        Scene(const Scene& s) = default;
+        Scene& operator = (const Scene& s) = default;
+        // The moved-from scene is left empty, so it needs a new revision
+        Scene(Scene&& s) : vertices_(std::move(s.vertices_)), triangles_(std::move(s.triangles_)),
+                           attribute_layout_(s.attribute_layout_), channels_(std::move(s.channels_)), meshlets_(std::move(s.meshlets_)),
+                           revision_(s.revision_){
+            s.attribute_layout_ = ATTRIBUTES_NONE;
+            s.revision_ = nextRevision();
+        }
+        Scene& operator = (Scene&& s){
+            vertices_ = std::move(s.vertices_);
+            triangles_ = std::move(s.triangles_);
+            attribute_layout_ = s.attribute_layout_;
+            channels_ = std::move(s.channels_);
+            meshlets_ = std::move(s.meshlets_);
+            s.attribute_layout_ = ATTRIBUTES_NONE;
+            revision_ = s.revision_;
+            s.revision_ = nextRevision();
+            return *this;
+        }
 
         // Getter for reference of triangles' vector used by the scene
-        std::vector<Triangle>& getSceneTriangles(){
+        const std::vector<Triangle>& getSceneTriangles() const {
             return triangles_;
         }
         // Getter for reference of vertices' vector 
-        std::vector<Vertex>& getSceneVertices(){
+        const std::vector<Vertex>& getSceneVertices() const {
+            return vertices_;
+        }
+
+        // References for modifying the triangles or the vertices, giving the scene a new revision (see the comment of
+        // the class). The meshlets no longer match the modified scene, so they are dropped.
+        std::vector<Triangle>& editTriangles(){
+            revision_ = nextRevision();
+            meshlets_.clear();
+            return triangles_;
+        }
+        std::vector<Vertex>& editVertices(){
+            revision_ = nextRevision();
+            meshlets_.clear();
             return vertices_;
         }
 
+        // Attributes carried by the vertices and values of a channel, one per vertex (empty if its attribute is not in the layout)
+        unsigned getAttributeLayout() const {
+            return attribute_layout_;
+        }
+        const std::vector<double>& getAttributeChannel(size_t channel) const {
+            return channels_.at(channel);
+        }
+
+        // Meshlets of the scene, empty unless set. They must cover the triangles in order, each one starting where the
+        // previous one ends; the pipeline then rejects whole meshlets outside the frustum or facing away from the camera.
+        // Reading the scene keeps them, editing it drops them: optimizeMesh has to be called again on the edited scene
+        const std::vector<Meshlet>& getMeshlets() const {
+            return meshlets_;
+        }
+        void setMeshlets(std::vector<Meshlet> meshlets){
+            size_t next = 0;
+            for (const Meshlet& m : meshlets){
+                if (m.first_triangle != next)
+                    throw std::invalid_argument("Meshlets must cover the triangles in order");
+                next += m.triangle_count;
+            }
+            if (!meshlets.empty() && next != triangles_.size())
+                throw std::invalid_argument("Meshlets must cover the triangles in order");
+            meshlets_ = std::move(meshlets);
+            revision_ = nextRevision();
+        }
+
+        unsigned long long getRevision() const {
+            return revision_;
+        }
+
         // Operator () overload, Scene(triangle_idx, vertex_idx) returns a Vertex reference to the "vertex_idx" Vertex of the "triangle_idx" Triangle of the Scene
         // Example: scene_ex(1, 0) returns the first Vertex of the second Triangle of Scene scene_ex
-        Vertex& operator()(const size_t triangle_idx, const size_t vertex_idx){
+        const Vertex& operator()(const size_t triangle_idx, const size_t vertex_idx) const {
             if (triangle_idx >= triangles_.size() || vertex_idx > 2)
                 throw std::out_of_range("Vertex out of range");
             return vertices_[((triangles_[triangle_idx])[vertex_idx])];
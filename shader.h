@@ -5,36 +5,129 @@ Marco Carfizzi 860149
 
 #include "frustum.h"
 
+// Group of fragments shaded with a single call, stored as structure of arrays (count values in each array)
+// an, bn, cn are the interpolated normal, u, v the texture coordinates and r, g, b the color (only given to computeSpan);
+// all arrays are always valid, with zeros for the attributes the scene doesn't have or the shader doesn't use
+struct FragmentSpan{
+    size_t count;
+    const double *x, *y, *z, *an, *bn, *cn, *u, *v, *r, *g, *b;
+};
+
 // Shader interface, application of the strategy pattern for the fragment shader
+// Shaders declare the vertex attributes they read in the static member "attributes" (a layout, see ATTRIBUTE_NORMAL):
+// the pipeline only interpolates those, the other parameters are zero. Since the interface can't know what an
+// implementation reads, it asks for all of them.
 template <typename target_t>
 class IFragmentShader{
     public:
+        static constexpr unsigned attributes = ATTRIBUTES_ALL;
+
         virtual target_t computeShader(double x, double y, double z, double an, double bn, double cn, double u, double v) = 0;
+
+        // Batched version used by the pipeline: shades the fragments of a span and writes span.count values in out
+        // The default implementation falls back to one computeShader call per fragment
+        virtual void computeSpan(const FragmentSpan& span, target_t* out){
+            for (size_t i = 0; i < span.count; i++)
+                out[i] = computeShader(span.x[i], span.y[i], span.z[i], span.an[i], span.bn[i], span.cn[i], span.u[i], span.v[i]);
+        }
+
         virtual ~IFragmentShader() {}
 };
 
+// Base for shaders known at compile time (curiously recurring template pattern): shader_t only defines
+//     target_t shade(double x, double y, double z, double an, double bn, double cn, double u, double v)
+// and both entry points call it directly, so it can be inlined in the span loop.
+// shader_t may hide "attributes" with the layout of the attributes it reads (all of them when it doesn't).
+// A Pipeline whose fourth template argument is a final shader_t skips the virtual call as well.
+template <typename shader_t, typename target_t>
+class FragmentShader : public IFragmentShader<target_t>{
+    public:
+        target_t computeShader(double x, double y, double z, double an, double bn, double cn, double u, double v) final {
+            return static_cast<shader_t*>(this)->shade(x, y, z, an, bn, cn, u, v);
+        }
+
+        void computeSpan(const FragmentSpan& span, target_t* out) final {
+            shader_t* shader = static_cast<shader_t*>(this);
+            for (size_t i = 0; i < span.count; i++)
+                out[i] = shader->shade(span.x[i], span.y[i], span.z[i], span.an[i], span.bn[i], span.cn[i], span.u[i], span.v[i]);
+        }
+};
+
+// Maximum number of fragments the pipeline collects before calling the shader
+constexpr size_t SHADE_BATCH = 64;
+
+// Fragments waiting to be shaded, together with the pixels their results are written to
+template <typename target_t>
+struct FragmentBatch{
+    size_t count = 0;
+    double x[SHADE_BATCH], y[SHADE_BATCH], z[SHADE_BATCH];
+    // Interpolated attributes, one array per channel, filled by the caller for the channels it interpolates
+    double attribute[ATTRIBUTE_CHANNELS][SHADE_BATCH];
+    target_t* pixel[SHADE_BATCH];
+
+    inline bool full() const {return count == SHADE_BATCH;}
+    // Queue a fragment, returning its index in the attribute arrays
+    inline size_t push(double fx, double fy, double fz, target_t* destination){
+        x[count] = fx;
+        y[count] = fy;
+        z[count] = fz;
+        pixel[count] = destination;
+        return count++;
+    }
+
+    // Shade the collected fragments with a single call and scatter the results to their pixels
+    // The channels of the attributes in "layout" are taken from the attribute arrays, the other ones are zeros
+    template <typename shader_t>
+    void flush(shader_t* shader, unsigned layout = ATTRIBUTES_NONE){
+        flush(shader, layout, [this](size_t i, const target_t& value){*pixel[i] = value;});
+    }
+
+    // Same as above, handing each result to store(i, value) instead of writing it to pixel[i]
+    template <typename shader_t, typename store_f>
+    void flush(shader_t* shader, unsigned layout, store_f&& store){
+        static const double zeros[SHADE_BATCH] = {};
+        if (count == 0)
+            return;
+        const double* channel[ATTRIBUTE_CHANNELS];
+        for (size_t c = 0; c < ATTRIBUTE_CHANNELS; c++)
+            channel[c] = (layout & channelAttribute(c)) ? attribute[c] : zeros;
+        target_t out[SHADE_BATCH];
+        shader->computeSpan(FragmentSpan{count, x, y, z, channel[0], channel[1], channel[2], channel[3], channel[4],
+                                         channel[5], channel[6], channel[7]}, out);
+        for (size_t i = 0; i < count; i++)
+            store(i, out[i]);
+        count = 0;
+    }
+};
+
 // Implementations of the strategy interface
 // Each shader can have multiple implementations and each implementation is hot-swappable
 // SimpleFragmentShader gives the first decimal of the value of z to the fragment, used when target_t is a char
-class SimpleFragmentShader : public IFragmentShader<char>{
+class SimpleFragmentShader final : public FragmentShader<SimpleFragmentShader, char>{
     public:
-        char computeShader(double x, double y, double z, double an, double bn, double cn,  double u, double v){
+        static constexpr unsigned attributes = ATTRIBUTES_NONE;
+
+        inline char shade(double x, double y, double z, double an, double bn, double cn,  double u, double v){
             return  48 + (int)((z - floor(z))*10);
         }
 };
 
 // Shader that produces a flat output by coloring the pixels with an 'x' (char case)
-class X2DFragmentShader : public IFragmentShader<char>{
+class X2DFragmentShader final : public FragmentShader<X2DFragmentShader, char>{
     public:
-        char computeShader(double x, double y, double z, double an, double bn, double cn, double u, double v){
+        static constexpr unsigned attributes = ATTRIBUTES_NONE;
+
+        inline char shade(double x, double y, double z, double an, double bn, double cn, double u, double v){
             return 'x';
         }
 };
 
 // SimpleIntShader gives the first decimal of the value of z to the fragment, used when target_t is an int
-class SimpleIntShader : public IFragmentShader<int>{
+class SimpleIntShader final : public FragmentShader<SimpleIntShader, int>{
     public:
-        int computeShader(double x, double y, double z, double an, double bn, double cn, double u,  double v){
+        static constexpr unsigned attributes = ATTRIBUTES_NONE;
+
+        inline int shade(double x, double y, double z, double an, double bn, double cn, double u,  double v){
             return ((z - floor(z))*10);
         }
 };
\ No newline at end of file
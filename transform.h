@@ -0,0 +1,197 @@
+/*  
+Giacomo Arrigo 860022
+Marco Carfizzi 860149
+*/
+
+#include "parallel.h"
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Entries of the projection matrix that depend only on the frustum, computed once per render instead of once per vertex
+// The projected coordinates are x_ = X*x_x + Z*x_z, y_ = Y*y_y + Z*y_z, z_ = Z*z_z + z_w and w_ = Z
+struct ProjectionCoefficients{
+    double x_x, x_z, y_y, y_z, z_z, z_w;
+
+    ProjectionCoefficients(ProjectionMatrix pm) :
+        x_x((2*pm.getNear())/(pm.getRight()-pm.getLeft())),
+        x_z(-(pm.getRight()+pm.getLeft())/(pm.getRight()-pm.getLeft())),
+        y_y((2*pm.getNear())/(pm.getBottom()-pm.getTop())),
+        y_z((-(pm.getBottom()+pm.getTop()))/(pm.getBottom()-pm.getTop())),
+        z_z((pm.getFar()+pm.getNear())/(pm.getFar()-pm.getNear())),
+        z_w((-2*pm.getNear()*pm.getFar())/(pm.getFar()-pm.getNear())){}
+};
+
+// Structure of arrays holding one coordinate per array, so that consecutive vertices can be loaded in a single SIMD register
+struct VertexBuffer{
+    std::vector<double> x, y, z;
+
+    size_t size() const {return x.size();}
+    void resize(size_t n){
+        x.resize(n);
+        y.resize(n);
+        z.resize(n);
+    }
+    void push_back(double vx, double vy, double vz){
+        x.push_back(vx);
+        y.push_back(vy);
+        z.push_back(vz);
+    }
+};
+
+// Scalar version of the projection, used for single vertices and for the ones left over by the SIMD loops
+inline void projectVertex(const ProjectionCoefficients& p, double X, double Y, double Z, double& ndx, double& ndy, double& ndz){
+    double x_ = X * p.x_x + Z * p.x_z;
+    double y_ = Y * p.y_y + Z * p.y_z;
+    double z_ = Z * p.z_z + p.z_w;
+    ndx = x_ / Z;
+    ndy = y_ / Z;
+    // z needs to be "traslated" from (-1, 1) to (0,2) and divided by 2 to get it in (0, 1). Needed for the z interpolation
+    ndz = (z_ / Z + 1) * 0.5;
+}
+
+// Affine transform placing a model in the camera space, p' = M p + t: m holds the rows of the 3x3 matrix M followed by
+// the components of t. The default one is the identity. Transforms are composed like matrices, (a * b) applies b first.
+struct ModelTransform{
+    double m[3][4] = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}};
+
+    static ModelTransform translation(double x, double y, double z){
+        ModelTransform t;
+        t.m[0][3] = x;
+        t.m[1][3] = y;
+        t.m[2][3] = z;
+        return t;
+    }
+    static ModelTransform scaling(double sx, double sy, double sz){
+        ModelTransform t;
+        t.m[0][0] = sx;
+        t.m[1][1] = sy;
+        t.m[2][2] = sz;
+        return t;
+    }
+    static ModelTransform scaling(double s){return scaling(s, s, s);}
+    // Rotations of "angle" radians around the axes
+    static ModelTransform rotationX(double angle){
+        ModelTransform t;
+        t.m[1][1] = t.m[2][2] = std::cos(angle);
+        t.m[1][2] = -std::sin(angle);
+        t.m[2][1] = std::sin(angle);
+        return t;
+    }
+    static ModelTransform rotationY(double angle){
+        ModelTransform t;
+        t.m[0][0] = t.m[2][2] = std::cos(angle);
+        t.m[0][2] = std::sin(angle);
+        t.m[2][0] = -std::sin(angle);
+        return t;
+    }
+    static ModelTransform rotationZ(double angle){
+        ModelTransform t;
+        t.m[0][0] = t.m[1][1] = std::cos(angle);
+        t.m[0][1] = -std::sin(angle);
+        t.m[1][0] = std::sin(angle);
+        return t;
+    }
+
+    ModelTransform operator * (const ModelTransform& b) const {
+        ModelTransform t;
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 4; j++)
+                t.m[i][j] = m[i][0] * b.m[0][j] + m[i][1] * b.m[1][j] + m[i][2] * b.m[2][j] + (j == 3 ? m[i][3] : 0);
+        return t;
+    }
+
+    double determinant() const {
+        return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+               m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    }
+
+    // Scale s when the 3x3 part is a rotation (or reflection) times s, so that it preserves angles; 0 otherwise
+    double similarityScale() const {
+        double gram[3][3];
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+                gram[i][j] = m[0][i] * m[0][j] + m[1][i] * m[1][j] + m[2][i] * m[2][j];
+        const double s2 = gram[0][0];
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+                if (std::abs(gram[i][j] - (i == j ? s2 : 0)) > 1e-12 * s2)
+                    return 0;
+        return std::sqrt(s2);
+    }
+
+    // Transform of the normals: the inverse transpose of the 3x3 part (cofactors over determinant), without translation
+    ModelTransform normalTransform() const {
+        ModelTransform t;
+        double cofactor[3][3];
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+                cofactor[i][j] = m[(i + 1) % 3][(j + 1) % 3] * m[(i + 2) % 3][(j + 2) % 3] - m[(i + 1) % 3][(j + 2) % 3] * m[(i + 2) % 3][(j + 1) % 3];
+        const double det = m[0][0] * cofactor[0][0] + m[0][1] * cofactor[0][1] + m[0][2] * cofactor[0][2];
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+                t.m[i][j] = cofactor[i][j] / det;
+        return t;
+    }
+
+    bool operator == (const ModelTransform& t) const {return std::equal(&m[0][0], &m[0][0] + 12, &t.m[0][0]);}
+    bool operator != (const ModelTransform& t) const {return !(*this == t);}
+    bool isIdentity() const {return *this == ModelTransform();}
+
+    inline void apply(double x, double y, double z, double& ox, double& oy, double& oz) const {
+        ox = m[0][0] * x + m[0][1] * y + m[0][2] * z + m[0][3];
+        oy = m[1][0] * x + m[1][1] * y + m[1][2] * z + m[1][3];
+        oz = m[2][0] * x + m[2][1] * y + m[2][2] * z + m[2][3];
+    }
+};
+
+// Copy the coordinates of the vertices in [begin, end) into a structure of arrays buffer (already sized)
+inline void gatherVertices(const std::vector<Vertex>& vertices, VertexBuffer& out, size_t begin, size_t end){
+    for (size_t i = begin; i < end; i++){
+        out.x[i] = vertices[i].getX();
+        out.y[i] = vertices[i].getY();
+        out.z[i] = vertices[i].getZ();
+    }
+}
+
+// Same as above, placing the vertices with a model transform on the way
+inline void gatherVertices(const std::vector<Vertex>& vertices, const ModelTransform& model, VertexBuffer& out, size_t begin, size_t end){
+    for (size_t i = begin; i < end; i++)
+        model.apply(vertices[i].getX(), vertices[i].getY(), vertices[i].getZ(), out.x[i], out.y[i], out.z[i]);
+}
+
+// Apply the perspective projection to the vertices in [begin, end) of "in" and store their ndc coordinates in "out" (already sized).
+// Vertices are processed 4 at a time with AVX, 2 at a time with SSE2 and one by one otherwise.
+// Every path does the same operations in the same order, so the results don't depend on the instruction set.
+inline void transformVertices(const ProjectionCoefficients& p, const VertexBuffer& in, VertexBuffer& out, size_t begin, size_t end){
+    size_t i = begin;
+#if defined(__AVX__)
+    const __m256d x_x = _mm256_set1_pd(p.x_x), x_z = _mm256_set1_pd(p.x_z), y_y = _mm256_set1_pd(p.y_y), y_z = _mm256_set1_pd(p.y_z);
+    const __m256d z_z = _mm256_set1_pd(p.z_z), z_w = _mm256_set1_pd(p.z_w), one = _mm256_set1_pd(1.0), half = _mm256_set1_pd(0.5);
+    for (; i + 4 <= end; i += 4){
+        __m256d X = _mm256_loadu_pd(&in.x[i]), Y = _mm256_loadu_pd(&in.y[i]), Z = _mm256_loadu_pd(&in.z[i]);
+        __m256d x_ = _mm256_add_pd(_mm256_mul_pd(X, x_x), _mm256_mul_pd(Z, x_z));
+        __m256d y_ = _mm256_add_pd(_mm256_mul_pd(Y, y_y), _mm256_mul_pd(Z, y_z));
+        __m256d z_ = _mm256_add_pd(_mm256_mul_pd(Z, z_z), z_w);
+        _mm256_storeu_pd(&out.x[i], _mm256_div_pd(x_, Z));
+        _mm256_storeu_pd(&out.y[i], _mm256_div_pd(y_, Z));
+        _mm256_storeu_pd(&out.z[i], _mm256_mul_pd(_mm256_add_pd(_mm256_div_pd(z_, Z), one), half));
+    }
+#elif defined(__SSE2__)
+    const __m128d x_x = _mm_set1_pd(p.x_x), x_z = _mm_set1_pd(p.x_z), y_y = _mm_set1_pd(p.y_y), y_z = _mm_set1_pd(p.y_z);
+    const __m128d z_z = _mm_set1_pd(p.z_z), z_w = _mm_set1_pd(p.z_w), one = _mm_set1_pd(1.0), half = _mm_set1_pd(0.5);
+    for (; i + 2 <= end; i += 2){
+        __m128d X = _mm_loadu_pd(&in.x[i]), Y = _mm_loadu_pd(&in.y[i]), Z = _mm_loadu_pd(&in.z[i]);
+        __m128d x_ = _mm_add_pd(_mm_mul_pd(X, x_x), _mm_mul_pd(Z, x_z));
+        __m128d y_ = _mm_add_pd(_mm_mul_pd(Y, y_y), _mm_mul_pd(Z, y_z));
+        __m128d z_ = _mm_add_pd(_mm_mul_pd(Z, z_z), z_w);
+        _mm_storeu_pd(&out.x[i], _mm_div_pd(x_, Z));
+        _mm_storeu_pd(&out.y[i], _mm_div_pd(y_, Z));
+        _mm_storeu_pd(&out.z[i], _mm_mul_pd(_mm_add_pd(_mm_div_pd(z_, Z), one), half));
+    }
+#endif
+    for (; i < end; i++)
+        projectVertex(p, in.x[i], in.y[i], in.z[i], out.x[i], out.y[i], out.z[i]);
+}
\ No newline at end of file
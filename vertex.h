@@ -10,35 +10,62 @@ Marco Carfizzi 860149
 #include <limits>
 #include <algorithm> 
 #include <cmath>
+#include <atomic>
+#include <stdexcept>
 
 // Class representing a 3d vertex and its coordinates
 class Vertex{
     private:
         // Constant, not-perspective projected coordinates, used because different pipelines (and different rendering behaviours) may re-use vertices
+        // The perspective projected coordinates are kept by each pipeline in its own buffers
         const double x_, y_, z_ = 0.0f;
-        // Perspective projected coordinates, re-calculated every time a pipeline renders, using the Vertex
-        double ndx_, ndy_, ndz_ = 0.0f;
 
     public:
         // Constructors
         Vertex() = default;
         Vertex(const double x, const double y, const double z): x_(x), y_(y), z_(z){}
-        Vertex(const Vertex& v) : x_(v.x_), y_(v.y_), z_(v.z_), ndx_(v.ndx_), ndy_(v.ndy_), ndz_(v.ndz_){}
+        Vertex(const Vertex& v) : x_(v.x_), y_(v.y_), z_(v.z_){}
 
         // Getters of the constant coordinates
-        double getX()  {return x_;}
-        double getY()  {return y_;}
-        double getZ()  {return z_;}
+        double getX() const {return x_;}
+        double getY() const {return y_;}
+        double getZ() const {return z_;}
 
-        // Getters of the pipeline-computed coordinates
-        double getNdx()  {return ndx_;}
-        double getNdy()  {return ndy_;}
-        double getNdz()  {return ndz_;}
+};
 
-        // Setters
-        void setNdx(const double x){ndx_ = x;}
-        void setNdy(const double y){ndy_= y;}
-        void setNdz(const double z){ndz_ = z;}
+// Attributes a vertex can carry besides its position, combined as bit flags into an attribute layout
+constexpr unsigned ATTRIBUTE_NORMAL = 1, ATTRIBUTE_UV = 2, ATTRIBUTE_COLOR = 4;
+constexpr unsigned ATTRIBUTES_NONE = 0, ATTRIBUTES_ALL = ATTRIBUTE_NORMAL | ATTRIBUTE_UV | ATTRIBUTE_COLOR;
 
+// Attributes are split in scalar channels: the normal (an, bn, cn), the texture coordinates (u, v) and the color (r, g, b)
+constexpr size_t ATTRIBUTE_CHANNELS = 8;
+constexpr size_t CHANNEL_NORMAL = 0, CHANNEL_UV = 3, CHANNEL_COLOR = 5;
 
-};
\ No newline at end of file
+// Attribute a channel belongs to
+constexpr unsigned channelAttribute(size_t channel){
+    return channel < CHANNEL_UV ? ATTRIBUTE_NORMAL : channel < CHANNEL_COLOR ? ATTRIBUTE_UV : ATTRIBUTE_COLOR;
+}
+
+// Number of channels of the attributes of a layout
+constexpr size_t layoutChannels(unsigned layout){
+    return ((layout & ATTRIBUTE_NORMAL) ? 3 : 0) + ((layout & ATTRIBUTE_UV) ? 2 : 0) + ((layout & ATTRIBUTE_COLOR) ? 3 : 0);
+}
+
+// Vertex carrying the attributes of a layout fixed at compile time, e.g. AttributeVertex<ATTRIBUTE_NORMAL | ATTRIBUTE_UV>.
+// Only the channels of the layout are stored, in channel order (normal, then uv, then color)
+// Example: AttributeVertex<ATTRIBUTE_UV> v(1.0, -1.0, 1.5, {{0.0, 1.0}});
+template <unsigned Layout>
+class AttributeVertex : public Vertex{
+    public:
+        static constexpr unsigned layout = Layout;
+        static constexpr size_t channels = layoutChannels(Layout);
+
+    private:
+        std::array<double, channels> values_;
+
+    public:
+        AttributeVertex(const double x, const double y, const double z, const std::array<double, channels>& values) : Vertex(x, y, z), values_(values){}
+
+        // Values of the channels of the layout
+        const std::array<double, channels>& getAttributes() const {return values_;}
+};